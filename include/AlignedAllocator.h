@@ -0,0 +1,38 @@
+/**************************************************
+AlignedAllocator is an allocator for std::vector
+whose storage starts on an Alignment-byte boundary,
+e.g. a cache line (64 bytes).  Before C++17 a plain
+std::vector does not honor alignas() of its elements.
+*****************************************************/
+#include <stdlib.h>
+#include <cstddef>
+#include <new>
+
+#ifndef __ALIGNEDALLOCATOR_H__
+#define __ALIGNEDALLOCATOR_H__
+
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator(){}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &){}
+
+    T* allocate(size_t n){
+        void* p = NULL;
+        if (posix_memalign(&p, Alignment, n * sizeof(T) > 0 ? n * sizeof(T) : Alignment) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t){ free(p); }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &){ return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &){ return false; }
+
+#endif
@@ -0,0 +1,112 @@
+/**************************************************
+Arena is a bump allocator: memory is handed out from
+large blocks and given back all at once, either by
+reset(), which keeps the blocks for reuse (e.g. once
+per frame), or by release() / the destructor.
+
+make<T>() constructs an object in the arena; objects
+that need their destructor run get it called on
+reset and release, in reverse order of creation.
+ArenaAllocator lets a std::vector (ArenaVector) take
+its storage from an arena; its memory is only given
+back with the arena's, so a vector should be sized
+once (reserve) rather than grown step by step.
+
+An arena is not thread-safe.
+*****************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024) : block_size(block_size) {}
+    ~Arena(){ release(); }
+
+    // bytes aligned to alignment (a power of two), valid until the next reset or release
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)){
+        if (!blocks.empty()) {
+            Block &b = blocks.back();
+            size_t start = (b.used + alignmentPadding(b.data + b.used, alignment));
+            if (start <= b.size && bytes <= b.size - start) {
+                b.used = start + bytes;
+                return b.data + start;
+            }
+        }
+        return allocateBlock(bytes, alignment);
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args){
+        T* object = new ( allocate(sizeof(T), alignof(T)) ) T( std::forward<Args>(args)... );
+        if (!std::is_trivially_destructible<T>::value) {
+            Destructor d = { object, &destroy<T> };
+            destructors.push_back(d);
+        }
+        return object;
+    }
+
+    // destroys the objects and rewinds; the memory is kept, as a single block
+    void reset(void);
+    // destroys the objects and frees the memory
+    void release(void);
+
+    size_t bytesUsed(void) const;
+    size_t bytesReserved(void) const;
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+    struct Destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+    std::vector<Block> blocks;
+    std::vector<Destructor> destructors;
+    size_t block_size;
+
+    static size_t alignmentPadding(const char* p, size_t alignment){
+        return size_t( -reinterpret_cast<uintptr_t>(p) & (alignment - 1) );
+    }
+    template <typename T>
+    static void destroy(void* p){ static_cast<T*>(p) -> ~T(); }
+    void* allocateBlock(size_t bytes, size_t alignment);
+    void destroyObjects(void);
+
+    Arena(const Arena &);
+    Arena& operator=(const Arena &);
+};
+
+// allocator for standard containers whose storage comes from an arena
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena &a) : arena(&a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T* allocate(size_t n){ return static_cast<T*>( arena -> allocate(n * sizeof(T), alignof(T)) ); }
+    void deallocate(T*, size_t){} // given back with the arena's memory
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b){ return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b){ return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector< T, ArenaAllocator<T> >;
+
+#endif
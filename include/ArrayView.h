@@ -0,0 +1,26 @@
+/**************************************************
+ArrayView is a read-only view of a contiguous array
+that it does not own, e.g. the contents of a
+std::vector or a section of a memory-mapped file.
+*****************************************************/
+#include <stddef.h>
+
+#ifndef __ARRAYVIEW_H__
+#define __ARRAYVIEW_H__
+
+template <typename T>
+struct ArrayView {
+    const T* data = NULL;
+    size_t count = 0;
+
+    ArrayView(){}
+    ArrayView(const T* ptr, size_t n) : data(ptr), count(n) {}
+    template <typename Vector>
+    ArrayView(const Vector &v) : data(v.empty() ? NULL : &v[0]), count(v.size()) {}
+
+    const T& operator[](size_t i) const { return data[i]; }
+    size_t size(void) const { return count; }
+    bool empty(void) const { return count == 0; }
+};
+
+#endif
@@ -0,0 +1,371 @@
+/**************************************************
+BVH is a bounding volume hierarchy over a list of
+primitive bounding boxes. It is built top-down with
+the surface area heuristic (SAH) and only stores
+primitive indices, so the same class can be used
+over triangles or over anything else with a box.
+
+The binary tree can be collapsed into a 4-wide or
+8-wide tree whose nodes keep the child boxes in
+structure-of-arrays form, so that all children of a
+node are tested against a ray in one SSE/AVX batch.
+
+The wide tree can also be stored compressed: child
+boxes quantized to 8 bits relative to the node box,
+in 64-byte aligned nodes laid out depth-first, so a
+4-wide node fills exactly one cache line.
+
+Two multithreaded builders are available: a task-
+parallel binned SAH build for tree quality, and a
+Morton-code LBVH (radix sort, then split on the
+highest differing bit) for near-instant rebuilds.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include "AlignedAllocator.h"
+#include "ArrayView.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+struct AABB {
+    glm::vec3 min = glm::vec3( std::numeric_limits<float>::infinity());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+    void grow(const glm::vec3 &p){
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    void grow(const AABB &b){
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+    glm::vec3 centroid(void) const { return 0.5f * (min + max); }
+    float area(void) const {
+        glm::vec3 e = max - min;
+        if (e.x < 0.0f) return 0.0f; // empty box
+        return 2.0f * (e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+};
+
+struct BVHNode {
+    AABB box;
+    int left_first; // index of the left child (interior node) or of the first primitive index (leaf)
+    int count;      // number of primitives in a leaf; 0 for an interior node
+    bool isLeaf(void) const { return count > 0; }
+};
+
+// W-wide node with the child boxes stored per axis.  Unused slots hold a
+// degenerate box at +infinity, which no ray can hit, and have count -1.
+template <int W>
+struct WideBVHNode {
+    static const int width = W;
+    float min_x[W], min_y[W], min_z[W];
+    float max_x[W], max_y[W], max_z[W];
+    int child[W]; // index of the child node, or of the first primitive index for a leaf child
+    int count[W]; // number of primitives of a leaf child; 0 for an interior child, -1 for an unused slot
+
+    WideBVHNode(){
+        const float inf = std::numeric_limits<float>::infinity();
+        for (int k = 0; k < W; k++) {
+            min_x[k] = min_y[k] = min_z[k] = inf;
+            max_x[k] = max_y[k] = max_z[k] = inf;
+            child[k] = -1;
+            count[k] = -1;
+        }
+    }
+
+    void setChild(int k, const AABB &box, int child_idx, int child_count){
+        min_x[k] = box.min.x; min_y[k] = box.min.y; min_z[k] = box.min.z;
+        max_x[k] = box.max.x; max_y[k] = box.max.y; max_z[k] = box.max.z;
+        child[k] = child_idx;
+        count[k] = child_count;
+    }
+    AABB childBox(int k) const {
+        AABB box;
+        box.min = glm::vec3(min_x[k], min_y[k], min_z[k]);
+        box.max = glm::vec3(max_x[k], max_y[k], max_z[k]);
+        return box;
+    }
+    int childCount(int k) const { return count[k]; }
+
+    // Slab test of all W children.  Returns a bit mask of the children hit
+    // within [0, tmax] and writes their entry distances into tnear.
+    int intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+        int mask = 0;
+        for (int k = 0; k < W; k++) {
+            float tx0 = (min_x[k] - org.x) * inv_dir.x, tx1 = (max_x[k] - org.x) * inv_dir.x;
+            float ty0 = (min_y[k] - org.y) * inv_dir.y, ty1 = (max_y[k] - org.y) * inv_dir.y;
+            float tz0 = (min_z[k] - org.z) * inv_dir.z, tz1 = (max_z[k] - org.z) * inv_dir.z;
+            float t0 = glm::max(glm::max(glm::min(tx0, tx1), glm::min(ty0, ty1)), glm::max(glm::min(tz0, tz1), 0.0f));
+            float t1 = glm::min(glm::min(glm::max(tx0, tx1), glm::max(ty0, ty1)), glm::min(glm::max(tz0, tz1), tmax));
+            tnear[k] = t0;
+            if (t0 <= t1) mask |= 1 << k;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE2__)
+template <>
+inline int WideBVHNode<4>::intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+    const __m128 ox = _mm_set1_ps(org.x), oy = _mm_set1_ps(org.y), oz = _mm_set1_ps(org.z);
+    const __m128 ix = _mm_set1_ps(inv_dir.x), iy = _mm_set1_ps(inv_dir.y), iz = _mm_set1_ps(inv_dir.z);
+    __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_x), ox), ix);
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_x), ox), ix);
+    __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_y), oy), iy);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_y), oy), iy);
+    __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_z), oz), iz);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_z), oz), iz);
+    __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                           _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+    __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                           _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tmax)));
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int WideBVHNode<8>::intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+    const __m256 ox = _mm256_set1_ps(org.x), oy = _mm256_set1_ps(org.y), oz = _mm256_set1_ps(org.z);
+    const __m256 ix = _mm256_set1_ps(inv_dir.x), iy = _mm256_set1_ps(inv_dir.y), iz = _mm256_set1_ps(inv_dir.z);
+    __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(min_x), ox), ix);
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(max_x), ox), ix);
+    __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(min_y), oy), iy);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(max_y), oy), iy);
+    __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(min_z), oz), iz);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(max_z), oz), iz);
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                              _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+    __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                              _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(tmax)));
+    _mm256_storeu_ps(tnear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+enum BVHBuildMode {
+    BVH_BINNED_SAH, // binned surface area heuristic, subtrees built as parallel tasks
+    BVH_LBVH        // linear BVH over radix-sorted Morton codes of the primitive centroids
+};
+
+// Compressed W-wide node.  A child box is stored as 8-bit offsets from the
+// node origin in steps of 2^exponent per axis.  The offsets are rounded
+// outwards, so the decoded box always contains the exact one.  q*2^e is
+// exact in single precision, which makes the decoding origin + q*scale
+// round the same way in the builder and in any traversal kernel.
+// sizeof is 64 bytes for W = 4 and 128 bytes for W = 8.
+template <int W>
+struct alignas(64) QuantizedBVHNode {
+    static const int width = W;
+    static const int max_leaf_size = 254; // count[] value 255 marks an unused slot
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t pad;
+    uint8_t qmin_x[W], qmin_y[W], qmin_z[W];
+    uint8_t qmax_x[W], qmax_y[W], qmax_z[W];
+    int32_t child[W]; // index of the child node, or of the first primitive index for a leaf child
+    uint8_t count[W]; // number of primitives of a leaf child; 0 for an interior child, 255 for an unused slot
+
+    QuantizedBVHNode(){
+        origin[0] = origin[1] = origin[2] = 0.0f;
+        exponent[0] = exponent[1] = exponent[2] = 0;
+        pad = 0;
+        for (int k = 0; k < W; k++) {
+            qmin_x[k] = qmin_y[k] = qmin_z[k] = 255;
+            qmax_x[k] = qmax_y[k] = qmax_z[k] = 0;
+            child[k] = -1;
+            count[k] = 255;
+        }
+    }
+
+    float scale(int axis) const {
+        // 2^exponent, built from its bit pattern (exponent is within the normal range)
+        int32_t bits = (int32_t(exponent[axis]) + 127) << 23;
+        float s;
+        memcpy(&s, &bits, sizeof(s));
+        return s;
+    }
+    int childCount(int k) const { return count[k] == 255 ? -1 : count[k]; }
+
+    int intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+        const float sx = scale(0), sy = scale(1), sz = scale(2);
+        int mask = 0;
+        for (int k = 0; k < W; k++) {
+            float tx0 = (origin[0] + qmin_x[k]*sx - org.x) * inv_dir.x, tx1 = (origin[0] + qmax_x[k]*sx - org.x) * inv_dir.x;
+            float ty0 = (origin[1] + qmin_y[k]*sy - org.y) * inv_dir.y, ty1 = (origin[1] + qmax_y[k]*sy - org.y) * inv_dir.y;
+            float tz0 = (origin[2] + qmin_z[k]*sz - org.z) * inv_dir.z, tz1 = (origin[2] + qmax_z[k]*sz - org.z) * inv_dir.z;
+            float t0 = glm::max(glm::max(glm::min(tx0, tx1), glm::min(ty0, ty1)), glm::max(glm::min(tz0, tz1), 0.0f));
+            float t1 = glm::min(glm::min(glm::max(tx0, tx1), glm::max(ty0, ty1)), glm::min(glm::max(tz0, tz1), tmax));
+            tnear[k] = t0;
+            if (t0 <= t1) mask |= 1 << k;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE4_1__)
+// decodes 4 quantized planes of one axis
+static inline __m128 decodePlanes4(const uint8_t *q, float origin, float scale){
+    int32_t packed;
+    memcpy(&packed, q, 4);
+    __m128 qf = _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128(packed) ) );
+    return _mm_add_ps( _mm_set1_ps(origin), _mm_mul_ps(qf, _mm_set1_ps(scale)) );
+}
+
+template <>
+inline int QuantizedBVHNode<4>::intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+    const __m128 ox = _mm_set1_ps(org.x), oy = _mm_set1_ps(org.y), oz = _mm_set1_ps(org.z);
+    const __m128 ix = _mm_set1_ps(inv_dir.x), iy = _mm_set1_ps(inv_dir.y), iz = _mm_set1_ps(inv_dir.z);
+    const float sx = scale(0), sy = scale(1), sz = scale(2);
+    __m128 tx0 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmin_x, origin[0], sx), ox), ix);
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmax_x, origin[0], sx), ox), ix);
+    __m128 ty0 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmin_y, origin[1], sy), oy), iy);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmax_y, origin[1], sy), oy), iy);
+    __m128 tz0 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmin_z, origin[2], sz), oz), iz);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(decodePlanes4(qmax_z, origin[2], sz), oz), iz);
+    __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                           _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+    __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                           _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tmax)));
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(__AVX2__)
+// decodes 8 quantized planes of one axis
+static inline __m256 decodePlanes8(const uint8_t *q, float origin, float scale){
+    __m256 qf = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)q ) ) );
+    return _mm256_add_ps( _mm256_set1_ps(origin), _mm256_mul_ps(qf, _mm256_set1_ps(scale)) );
+}
+
+template <>
+inline int QuantizedBVHNode<8>::intersect(const glm::vec3 &org, const glm::vec3 &inv_dir, float tmax, float *tnear) const {
+    const __m256 ox = _mm256_set1_ps(org.x), oy = _mm256_set1_ps(org.y), oz = _mm256_set1_ps(org.z);
+    const __m256 ix = _mm256_set1_ps(inv_dir.x), iy = _mm256_set1_ps(inv_dir.y), iz = _mm256_set1_ps(inv_dir.z);
+    const float sx = scale(0), sy = scale(1), sz = scale(2);
+    __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmin_x, origin[0], sx), ox), ix);
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmax_x, origin[0], sx), ox), ix);
+    __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmin_y, origin[1], sy), oy), iy);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmax_y, origin[1], sy), oy), iy);
+    __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmin_z, origin[2], sz), oz), iz);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(decodePlanes8(qmax_z, origin[2], sz), oz), iz);
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                              _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+    __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+                              _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(tmax)));
+    _mm256_storeu_ps(tnear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+class BVH {
+public:
+    // nodes[0] is the root.  The two children of an interior node are stored
+    // next to each other at nodes[left_first] and nodes[left_first+1].
+    std::vector<BVHNode> nodes;
+    // Leaves refer to the range indices[left_first, left_first+count),
+    // which are indices into the primitive list the tree was built over.
+    std::vector<int> indices;
+
+    // Collapsed copies of the binary tree; only the one matching width (and
+    // quantized) is filled.  Their leaves refer to the same ranges of indices.
+    // Nodes are stored depth-first from cache-line aligned storage.
+    int width = 2; // 2 (binary), 4 or 8
+    bool quantized = false; // compressed wide nodes instead of full-precision ones
+    std::vector< WideBVHNode<4>, AlignedAllocator< WideBVHNode<4> > > nodes4;
+    std::vector< WideBVHNode<8>, AlignedAllocator< WideBVHNode<8> > > nodes8;
+    std::vector< QuantizedBVHNode<4>, AlignedAllocator< QuantizedBVHNode<4> > > qnodes4;
+    std::vector< QuantizedBVHNode<8>, AlignedAllocator< QuantizedBVHNode<8> > > qnodes8;
+
+    BVHBuildMode mode = BVH_BINNED_SAH;
+
+    // With leaf_alignment > 1, every leaf holds at most that many primitives
+    // (unless it cannot be split) and starts at a multiple of it in indices,
+    // the gaps being filled with -1.  Primitives packed into SIMD blocks of
+    // that width in index order (see TriangleBlock) then line up with leaves.
+    int leaf_alignment = 1;
+    int primitive_count = 0; // number of primitives the tree was built over
+
+    // What traversal reads.  After a build, refit or collapse these view the
+    // vectors above; a tree loaded from a cache file (see RTCache) views the
+    // mapped file instead and leaves the vectors empty until it is changed.
+    struct View {
+        ArrayView<BVHNode> nodes;
+        ArrayView<int> indices;
+        ArrayView< WideBVHNode<4> > nodes4;
+        ArrayView< WideBVHNode<8> > nodes8;
+        ArrayView< QuantizedBVHNode<4> > qnodes4;
+        ArrayView< QuantizedBVHNode<8> > qnodes8;
+    };
+    View view;
+    bool empty(void) const { return view.nodes.empty(); }
+
+    // A copy views its own vectors wherever the original viewed its own, and the
+    // same mapped file wherever the original viewed one.  A move keeps the storage.
+    BVH(){}
+    BVH(const BVH &other){ *this = other; }
+    BVH& operator=(const BVH &other);
+    BVH(BVH &&other) = default;
+    BVH& operator=(BVH &&other) = default;
+
+    void build(const std::vector<AABB> &bounds); // also collapses to the current width
+    void refit(const std::vector<AABB> &bounds);  // new primitive boxes, same topology
+    void collapse(int new_width);
+    void collapse(int new_width, bool new_quantized);
+    float cost(void) const; // SAH cost of the tree, relative to the root
+    size_t bytes(void) const; // memory of the nodes traversed at the current width, plus indices
+    // whether the view is a tree over primitive_count primitives that can be traversed
+    // without leaving its arrays, for a tree read from a file
+    bool valid(void) const;
+    const char* modeName(void) const;
+
+    // statistics of the last build
+    float build_cost = 0.0f; // cost() right after the build, to judge refitted trees against
+    float build_time = 0.0f; // wall-clock time of the build in milliseconds
+
+    // cost model of the surface area heuristic
+    static constexpr float traversal_cost = 1.0f;
+    static constexpr float intersect_cost = 1.0f;
+    static const int bin_count = 16;
+    static const int max_leaf_size = 8;
+    static const int max_depth = 64;    // bounds the depth of the binary tree
+    static const int max_stack_depth = max_depth + 8; // leaves too large for a quantized node add a few levels
+    static const int lbvh_leaf_size = 4;
+
+    // parallelism of the builders
+    static const int task_min_size = 4096;  // smallest subtree built as its own task
+    static const int chunk_min_size = 65536; // smallest range a loop over primitives is split into
+
+private:
+    int spawn_depth = 0; // subtrees above this depth may be built as parallel tasks
+
+    int leafSize(int unaligned_size) const { return leaf_alignment > 1 ? leaf_alignment : unaligned_size; }
+    // primitives of a leaf are tested a block of leaf_alignment at a time
+    int leafCost(int count) const { return (count + leaf_alignment - 1) / leaf_alignment; }
+    void alignLeaves(void);
+
+    void updateBounds(int node_idx, const std::vector<AABB> &bounds);
+    void updateAllBounds(const std::vector<AABB> &bounds);
+    void subdivide(int node_idx, const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+                   int depth, std::atomic<int> &node_count);
+    void buildLBVH(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids, std::atomic<int> &node_count);
+    void splitLBVH(int node_idx, const std::vector<uint32_t> &codes, int depth, std::atomic<int> &node_count);
+    template <typename WideVector>
+    int collapseNode(WideVector &wide, int node_idx) const;
+    template <int W, typename WideVector, typename QuantizedVector>
+    void quantize(const WideVector &wide, QuantizedVector &out) const;
+};
+
+#endif
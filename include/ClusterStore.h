@@ -0,0 +1,127 @@
+/**************************************************
+ClusterStore keeps a flattened scene out of core, for
+scenes whose triangle soup does not fit in memory.
+
+The world-space triangles are grouped into spatially
+coherent clusters (runs of cells of a Morton-ordered
+grid, a few thousand triangles each) and written to
+a file together with a BVH per cluster.  Only a BVH
+over the cluster boxes stays in memory.  The file is
+mapped, and a cluster is paged in (its BVH collapsed
+and its triangles packed into blocks) the first time
+a ray reaches its box; the least recently used ones
+are evicted to stay within a budget of resident
+bytes.  The positions, normals and materials that
+resolve a hit are read from the mapping directly.
+
+The triangles are written in two streaming passes
+(count, then place), so the whole soup is never in
+memory at once.  The store is not thread-safe.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BVH.h"
+#include "Triangle.h"
+#include "TriangleBlock.h"
+#include "TriangleSoup.h"
+#include "RTCache.h"
+
+#ifndef __CLUSTERSTORE_H__
+#define __CLUSTERSTORE_H__
+
+// what traversal reads of a resident cluster; its primitives are the cluster's triangles
+struct ClusterPage {
+    BVH bvh;
+    TriangleBlockArray blocks;
+    size_t bytes = 0;
+};
+
+class ClusterStore {
+public:
+    BVH bvh; // over the cluster boxes, in memory
+    size_t budget = size_t(512) << 20; // resident bytes of the paged-in clusters
+    int cluster_size = 16384; // most triangles per cluster
+
+    // statistics of the current frame (see beginFrame), and of what is resident
+    size_t page_ins = 0;
+    size_t evictions = 0;
+    size_t resident_bytes = 0;
+    size_t resident_count = 0;
+
+    ClusterStore(){}
+    ~ClusterStore(){ close(); }
+
+    // Building, in this order: begin, count every batch of the soup, layout, write the
+    // same batches in the same order, finish.  The clusters go to a new file named
+    // after path (layout sets path to it), which only lives until finish has mapped
+    // it.  layout and finish print why and return false if the file cannot be written.
+    void begin(const std::string &path, const AABB &bounds);
+    void count(const TriangleSoup &batch);
+    bool layout(void);
+    void write(const TriangleSoup &batch);
+    bool finish(int width, bool quantized, BVHBuildMode mode);
+    void close(void);
+
+    size_t size(void) const { return clusters.size(); }
+    size_t triangleCount(void) const { return triangle_count; }
+    bool empty(void) const { return clusters.empty(); }
+    const AABB& box(int c) const { return clusters[c].box; }
+
+    // the BVH and blocks of cluster c, paged in if needed; valid until the next acquire
+    const ClusterPage& acquire(int c);
+    // triangle i of cluster c, read from the mapped file
+    Triangle triangle(int c, int i) const;
+
+    void beginFrame(void){ page_ins = 0; evictions = 0; }
+    void printFrameStats(void) const;
+    void setBudget(size_t bytes); // evicts down to the new budget
+
+private:
+    // where a cluster is in the file; the triangle streams are laid out like a TriangleSoup
+    struct Cluster {
+        AABB box;
+        uint64_t offset = 0;       // positions (3 per triangle), then normals, then materials
+        uint32_t triangle_count = 0;
+        uint64_t bvh_offset = 0;   // binary nodes, then indices
+        uint32_t node_count = 0;
+        uint32_t index_count = 0;
+        std::unique_ptr<ClusterPage> page; // resident copy, if any
+        std::list<int>::iterator lru;      // position in lru while resident
+    };
+    std::vector<Cluster> clusters;
+    std::list<int> lru; // resident clusters, most recently used first
+    size_t triangle_count = 0;
+    int width = 2;
+    bool quantized = false;
+
+    // building
+    std::string path;
+    AABB grid_box;
+    std::vector<uint64_t> cell_count;     // triangles in every grid cell
+    std::vector<uint32_t> cell_cluster;   // first cluster of the cell
+    std::vector<uint32_t> cell_slot;      // first slot of the cell in its cluster
+    std::vector<uint64_t> cell_written;   // triangles of the cell written so far
+    static const int grid_bits = 6;       // 2^grid_bits cells per axis
+    int fd = -1;
+    char* writable = NULL; // the triangle streams, mapped for writing
+    size_t writable_size = 0;
+
+    std::shared_ptr<MappedFile> file; // the finished file, mapped for reading
+
+    uint32_t cellOf(const glm::vec3 *P) const;
+    void evict(int c);
+    void fitBudget(int keep);
+    void adviseDone(int c) const;
+    const char* base(void) const { return file ? file -> data : writable; }
+    const glm::vec3* positions(int c) const;
+    const glm::vec3* normals(int c) const;
+    const MaterialId* materials(int c) const;
+};
+
+#endif
@@ -0,0 +1,31 @@
+/**************************************************
+GLBLoader imports a binary glTF 2.0 (.glb) file into
+an RTScene.  Every mesh primitive becomes a geometry
+and a model of the scene's palettes, every material
+a material, and the node hierarchy becomes RTNodes
+with the nodes' local transforms as child transforms.
+
+The vertex and index data are not parsed: the file
+is mapped into memory and the meshes view positions,
+normals and 32-bit indices in place (other layouts
+are copied out without any text conversion).  Only
+the JSON chunk describing the scene is parsed.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include "RTScene.h"
+
+#ifndef __GLBLOADER_H__
+#define __GLBLOADER_H__
+
+namespace GLBLoader {
+    // Adds the default scene of the file at path to scene.  Its objects are
+    // named after path in the palettes, and its root nodes become children of
+    // parent under transform.  Prints why and returns false if the file cannot
+    // be imported, in which case the palettes and the graph of scene are left
+    // unchanged (what was made of the file stays in the scene's arena until the
+    // scene is destroyed).
+    bool load(const char* path, RTScene &scene, RTNode* parent, const glm::mat4 &transform = glm::mat4(1.0f));
+}
+
+#endif
@@ -1,28 +1,28 @@
 /**************************************************
-Geometry is an abstract class for a geometric object.
- A derived class of Geometry will have an implemention of
-   ```void init(void)```
- or
-   ```void init(const char* s).```
- The option for const char* input is for a derived class
- that requires reading external files.
- The implementation of the `init` is for initializing the
- geometry (i.e. setting up the buffers etc).
- 
+Geometry holds the OpenGL buffers of one mesh of the
+scene.  The mesh itself lives in an RTGeometry (the
+one CPU-side copy, also used by the ray tracer);
+ ```void init(const RTGeometry &mesh)```
+uploads its indexed vertex arrays.  The triangles of
+its levels of detail follow the full mesh in the
+index buffer, over the same vertex arrays, and
+ ```draw(level)``` draws one of them.
+
  The draw command is fixed.  We can call
- 
+
  glBindVertexArray(obj.vao);
  glDrawElements(obj.mode, obj.count, obj.type, 0);
- 
+
 which should explain the purpose of those class members.
  We can also just call the "draw()" member function, which
  is equivalent to the commands above.
- 
+
 The array of buffers is encapsulated in std::vector so
 we do not need to manually allocate/free the memory for
 arrays of unknown size.
 *****************************************************/
 #include <vector>
+#include "RTGeometry.h"
 
 #ifndef __GEOMETRY_H__
 #define __GEOMETRY_H__
@@ -34,14 +34,72 @@ public:
     GLenum type = GL_UNSIGNED_INT; // type of the index array
     GLuint vao; // vertex array object a.k.a. geometry spreadsheet
     std::vector<GLuint> buffers; // data storage
-    
-    virtual void init(){};
-    virtual void init(const char* s){};
-    
-    void draw(void){
+    // index range of every level of detail (level 0 is the full mesh), and its error in model units
+    std::vector<int> level_first;
+    std::vector<int> level_count;
+    std::vector<float> level_error;
+    // bounding sphere of the mesh, in the model coordinate
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    void init(const RTGeometry &mesh){
+        glGenVertexArrays(1, &vao );
+        buffers.resize(3); // recall that buffers is std::vector<GLuint>
+        glGenBuffers(3, buffers.data());
+        glBindVertexArray(vao);
+
+        // 0th attribute: position
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, mesh.view.positions.size()*sizeof(glm::vec3), mesh.view.positions.data, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,0,(void*)0);
+
+        // 1st attribute: normal
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+        glBufferData(GL_ARRAY_BUFFER, mesh.view.normals.size()*sizeof(glm::vec3), mesh.view.normals.data, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,0,(void*)0);
+
+        // indices: the three vertex indices of every triangle, level after level
+        size_t total = 0;
+        level_first.clear();
+        level_count.clear();
+        level_error.clear();
+        for (int l = 0; l < mesh.levelCount(); l++) {
+            level_first.push_back( int(3 * total) );
+            level_count.push_back( int(3 * mesh.levelTriangles(l).size()) );
+            level_error.push_back( l == 0 ? 0.0f : mesh.levels[l-1].error );
+            total += mesh.levelTriangles(l).size();
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, total*sizeof(glm::uvec3), NULL, GL_STATIC_DRAW);
+        for (int l = 0; l < mesh.levelCount(); l++) {
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, level_first[l]*sizeof(GLuint), level_count[l]*sizeof(GLuint), mesh.levelTriangles(l).data);
+        }
+
+        count = level_count[0];
+        glBindVertexArray(0);
+
+        AABB box;
+        for (size_t i = 0; i < mesh.view.positions.size(); i++) box.grow( mesh.view.positions[i] );
+        if (box.min.x <= box.max.x) {
+            center = 0.5f * (box.min + box.max);
+            radius = 0.5f * glm::length(box.max - box.min);
+        }
+    }
+
+    // the coarsest level whose error is at most max_error, for a mesh drawn at
+    // pixels_per_unit pixels per model unit
+    int selectLevel(float pixels_per_unit, float max_error) const {
+        int level = 0;
+        for (int l = 1; l < int(level_error.size()) && level_error[l] * pixels_per_unit <= max_error; l++) level = l;
+        return level;
+    }
+
+    void draw(int level = 0){
         glBindVertexArray(vao);
-        glDrawElements(mode,count,type,0);
+        glDrawElements(mode,level_count[level],type,(void*)(level_first[level]*sizeof(GLuint)));
     }
 };
 
-#endif 
+#endif
@@ -3,7 +3,9 @@
 #include <vector>
 #include <limits>
 
-#include "Triangle.h"
+#include "Material.h"
+
+struct RTInstance;
 
 #ifndef __INTERSECTION_H__
 #define __INTERSECTION_H__
@@ -12,7 +14,9 @@ struct Intersection {
     glm::vec3 P; // position of the intersection
     glm::vec3 N; // surface normal
     glm::vec3 V; // direction to incoming ray
-    Triangle* triangle; // pointer to geometric primitive (and material info)
+    MaterialId material; // material of the hit (the triangle's, or the model instance's), in RTScene::materials
     float dist; // distance to the source of ray
+    const RTInstance* instance = NULL; // instance hit, NULL for the triangle soup and the clusters
+    float lod_gap = 0.0f; // how far from P the level of detail of the secondary rays may be (see RTScene::secondary_lod)
 };
 #endif
@@ -3,6 +3,7 @@
 *****************************************************/
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
+#include <stdint.h>
 
 #ifndef __MATERIAL_H__
 #define __MATERIAL_H__
@@ -15,4 +16,7 @@ struct Material {
     float shininess = 10.0f;
 };
 
+// index of a material in the dense table of the ray tracer (RTScene::materials)
+typedef uint16_t MaterialId;
+
 #endif 
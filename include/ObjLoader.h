@@ -0,0 +1,32 @@
+/**************************************************
+ObjLoader reads the mesh of a Wavefront .obj file.
+
+The file is mapped into memory and cut at line ends
+into one chunk per thread.  The chunks are parsed in
+parallel (with a float and integer parser of its
+own rather than scanf), then their vertex and face
+arrays are concatenated into the indexed mesh.
+
+Supported: "v x y z", "vn x y z" and "f" lines whose
+corners are v, v/vt, v//vn or v/vt/vn, with any
+number of corners (a polygon is split into a fan of
+triangles) and negative (relative) indices.  Texture
+coordinates are ignored, and corners without a normal
+get the smooth normal of their position.  All other
+lines are skipped.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include "RTGeometry.h"
+
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+
+namespace ObjLoader {
+    // Fills the positions, normals and triangles of geom from the file at path
+    // and updates its view.  Prints why and returns false if the file cannot be
+    // read, in which case geom is left unchanged.
+    bool load(const char* path, RTGeometry &geom);
+}
+
+#endif
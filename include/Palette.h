@@ -0,0 +1,59 @@
+/**************************************************
+Palette is a container of named objects, such as the
+geometries, materials, models, lights and nodes of a
+scene; it does not own them (a scene keeps them in
+its arena).  A name is interned into a dense
+index the first time it is used, which is only needed
+while the scene is loaded; afterwards the objects are
+reached by index or iterated in index order, without
+any string lookup or copy.
+*****************************************************/
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+template <typename T>
+class Palette {
+public:
+    typedef size_t Index;
+    static const Index none = Index(-1);
+
+    Palette(){}
+    Palette(const Palette&) = delete;
+    Palette& operator=(const Palette&) = delete;
+
+    // Slot of the object called name, added empty (NULL) on first use; the
+    // reference is valid until the next name is added.
+    T*& operator[](const std::string &name){
+        typename std::unordered_map<std::string, Index>::const_iterator found = index_of.find(name);
+        if (found != index_of.end()) return items[found->second];
+        index_of[name] = items.size();
+        names.push_back(name);
+        items.push_back(NULL);
+        return items.back();
+    }
+    T* operator[](Index i) const { return items[i]; }
+
+    // index of the object called name, or none
+    Index find(const std::string &name) const {
+        typename std::unordered_map<std::string, Index>::const_iterator found = index_of.find(name);
+        return found == index_of.end() ? none : found->second;
+    }
+    const std::string& name(Index i) const { return names[i]; }
+
+    size_t size(void) const { return items.size(); }
+    bool empty(void) const { return items.empty(); }
+    typename std::vector<T*>::const_iterator begin(void) const { return items.begin(); }
+    typename std::vector<T*>::const_iterator end(void) const { return items.end(); }
+
+private:
+    std::vector<T*> items;           // in the order the names were added
+    std::vector<std::string> names;  // name of each item
+    std::unordered_map<std::string, Index> index_of;
+};
+
+#endif
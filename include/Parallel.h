@@ -0,0 +1,35 @@
+/**************************************************
+Parallel.h splits a loop over n items into chunks
+that run on their own threads, as used by the BVH
+builds and by the flattening of the scene.
+*****************************************************/
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+inline int threadCount(void){
+    // hardware_concurrency() may query the OS, so ask once
+    static const int n = std::max(1, int( std::thread::hardware_concurrency() ));
+    return n;
+}
+
+// number of chunks a loop over n items is split into
+inline int chunkCount(int n, int min_chunk){
+    return std::max(1, std::min(threadCount(), n / min_chunk));
+}
+
+// calls fn(chunk, begin, end) for every chunk of [0, n), one thread per chunk
+template <typename F>
+void parallelChunks(int n, int chunks, F fn){
+    std::vector<std::thread> workers;
+    for (int c = 1; c < chunks; c++) {
+        workers.push_back( std::thread(fn, c, int( (long long)n * c / chunks ), int( (long long)n * (c+1) / chunks )) );
+    }
+    fn(0, 0, int( (long long)n / chunks ));
+    for (std::thread &w : workers) w.join();
+}
+
+#endif
@@ -0,0 +1,54 @@
+/**************************************************
+RTCache keeps the indexed mesh of a loaded model,
+its levels of detail and its bottom-level BVH in a
+binary file next to the model (model.obj ->
+model.obj.rtcache), so that later runs skip parsing,
+simplifying and building.  The BVHs of the levels
+are not kept; they are small and only built when
+the levels are traced.
+
+The file is keyed by a hash of the model file's
+contents and carries a format version, so a stale
+or foreign cache is simply rebuilt.  It is mapped
+into memory when loaded: the mesh and the BVH are
+used in place without copying, and processes that
+load the same model share its pages.
+*****************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "RTGeometry.h"
+
+#ifndef __RTCACHE_H__
+#define __RTCACHE_H__
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    const char* data = NULL;
+    size_t size = 0;
+
+    MappedFile(){}
+    ~MappedFile();
+    bool open(const char* path);
+    void close(void);
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile& operator=(const MappedFile &);
+};
+
+namespace RTCache {
+    const uint32_t version = 4; // bump whenever the file layout changes
+
+    bool hashFile(const char* path, uint64_t &hash);
+    std::string cachePath(const std::string &source);
+
+    // Fills geom from the cache of geom.source if it is up to date; always
+    // sets geom.source_hash.  geom keeps the file mapped while it uses it.
+    bool load(RTGeometry &geom);
+    // Writes the mesh, the levels of detail and the bottom-level BVH of geom.
+    void save(const RTGeometry &geom);
+}
+
+#endif
@@ -11,7 +11,7 @@ public:
 
     void init(void){
         // vertex positions
-        const GLfloat positions[24][3] ={
+        const GLfloat cube_positions[24][3] ={
             // Front face
             { -0.5f, -0.5f, 0.5f },{ -0.5f, 0.5f, 0.5f },{ 0.5f, 0.5f, 0.5f },{ 0.5f, -0.5f, 0.5f },
             // Back face
@@ -26,7 +26,7 @@ public:
             { 0.5f, -0.5f, 0.5f },{ -0.5f, -0.5f, 0.5f },{ -0.5f, -0.5f, -0.5f },{ 0.5f, -0.5f, -0.5f }
         };
         // vertex normals
-        const GLfloat normals[24][3] = {
+        const GLfloat cube_normals[24][3] = {
             // Front face
             { 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f, 1.0f },
             // Back face
@@ -50,28 +50,15 @@ public:
             20, 21, 22, 20, 22, 23 // Bottom face
         };
         
-        //set up list of triangles
-        for (unsigned int i=0; i<36; i++) {
-            Triangle t;
-            
-            //triangle positions & normals
-            t.P.push_back(glm::vec3(positions[indices[i]][0],positions[indices[i]][1],
-                                    positions[indices[i]][2]));
-            t.N.push_back(glm::vec3(normals[indices[i]][0],normals[indices[i]][1],
-                                    normals[indices[i]][2]));
-            i++;
-            t.P.push_back(glm::vec3(positions[indices[i]][0],positions[indices[i]][1],
-                                    positions[indices[i]][2]));
-            t.N.push_back(glm::vec3(normals[indices[i]][0],normals[indices[i]][1],
-                                    normals[indices[i]][2]));
-            i++;
-            t.P.push_back(glm::vec3(positions[indices[i]][0],positions[indices[i]][1],
-                                    positions[indices[i]][2]));
-            t.N.push_back(glm::vec3(normals[indices[i]][0],normals[indices[i]][1],
-                                    normals[indices[i]][2]));
-            
-            elements.push_back(t);
+        //set up the indexed mesh
+        for (unsigned int i=0; i<24; i++) {
+            positions.push_back(glm::vec3(cube_positions[i][0], cube_positions[i][1], cube_positions[i][2]));
+            normals.push_back(glm::vec3(cube_normals[i][0], cube_normals[i][1], cube_normals[i][2]));
         }
+        for (unsigned int i=0; i<36; i+=3) {
+            triangles.push_back(glm::uvec3(indices[i], indices[i+1], indices[i+2]));
+        }
+        updateView();
         
         count = sizeof(indices)/sizeof(indices[0]);
     }
@@ -1,13 +1,152 @@
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <stdint.h>
 #include "Triangle.h"
+#include "BVH.h"
+#include "TriangleBlock.h"
+#include "ArrayView.h"
+#include "Simplify.h"
 #ifndef __RTGEOMETRY_H__
 #define __RTGEOMETRY_H__
 
+class MappedFile;
+
 class RTGeometry {
 public:
     int count; // number of elements to draw
-    std::vector<Triangle> elements; // list of triangles
+    // Indexed mesh: vertex arrays shared by all the triangles, and the three
+    // vertex indices of every triangle.
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals; // one per position
+    std::vector<glm::uvec3> triangles;
+    TriangleBlockArray blocks; // triangles packed for the ray-triangle test, in the order of bvh.view.indices
+    BVH bvh; // bottom-level hierarchy over the triangles, in the model coordinate
+    std::string source; // file the mesh was loaded from, if any
+    uint64_t source_hash = 0; // content hash of source, which keys its cache file
+    std::shared_ptr<MappedFile> cache; // mapped file the mesh (and maybe the bvh) is viewed in, if any (see RTCache, GLBLoader)
+
+    // What everything else reads.  updateView() points it at the vectors
+    // above; a mesh loaded from a cache file views the mapped file instead.
+    struct View {
+        ArrayView<glm::vec3> positions;
+        ArrayView<glm::vec3> normals;
+        ArrayView<glm::uvec3> triangles;
+    };
+    View view;
+
+    // Coarser levels of detail 1, 2, ... (level 0 is the mesh above), each about half
+    // the triangles of the one before, over the same vertex arrays (see Simplify).
+    // The ray tracer traces them with a BVH and blocks of their own.
+    struct Level {
+        std::vector<glm::uvec3> triangles;
+        ArrayView<glm::uvec3> view; // what everything reads: triangles, or a section of the cache file
+        float error = 0.0f;         // how far the surface moved from the full mesh, in model units
+        BVH bvh;
+        TriangleBlockArray blocks;
+    };
+    std::vector<Level> levels;
+    static const size_t lod_min_triangles = 256; // no level is made with fewer triangles
+    static const int lod_max_levels = 8;
+
+    virtual ~RTGeometry(){}
     virtual void init(){};
     virtual void init(const char* s){};
+
+    void updateView(void){
+        view.positions = positions;
+        view.normals = normals;
+        view.triangles = triangles;
+        for (Level &l : levels) l.view = l.triangles;
+    }
+    // Simplifies the mesh into levels, replacing any there were.
+    void buildLevels(void){
+        std::vector<Simplify::Level> simplified = Simplify::buildLevels(view.positions, view.normals, view.triangles,
+                                                                        lod_min_triangles, lod_max_levels);
+        levels.clear();
+        levels.resize(simplified.size());
+        for (size_t l = 0; l < simplified.size(); l++) {
+            levels[l].triangles.swap(simplified[l].triangles);
+            levels[l].view = levels[l].triangles;
+            levels[l].error = simplified[l].error;
+        }
+    }
+
+    // The accessors below take any level: past the coarsest one, they give the coarsest one.
+    int levelCount(void) const { return 1 + int(levels.size()); }
+    int clampLevel(int level) const { return std::min(level, int(levels.size())); }
+    const ArrayView<glm::uvec3>& levelTriangles(int level) const {
+        level = clampLevel(level);
+        return level == 0 ? view.triangles : levels[level-1].view;
+    }
+    float levelError(int level) const {
+        level = clampLevel(level);
+        return level == 0 ? 0.0f : levels[level-1].error;
+    }
+    const BVH& levelBVH(int level) const {
+        level = clampLevel(level);
+        return level == 0 ? bvh : levels[level-1].bvh;
+    }
+    const TriangleBlockArray& levelBlocks(int level) const {
+        level = clampLevel(level);
+        return level == 0 ? blocks : levels[level-1].blocks;
+    }
+
+    size_t triangleCount(void) const { return view.triangles.size(); }
+    // copy of triangle i of a level with its own vertices (and no material)
+    Triangle triangle(size_t i, int level = 0) const {
+        const glm::uvec3 &tri = levelTriangles(level)[i];
+        Triangle t;
+        for (int j = 0; j < 3; j++) {
+            t.P[j] = view.positions[ tri[j] ];
+            t.N[j] = view.normals[ tri[j] ];
+        }
+        return t;
+    }
+    TriangleEdges edges(size_t i, int level = 0) const {
+        const glm::uvec3 &tri = levelTriangles(level)[i];
+        return TriangleEdges(view.positions[tri[0]], view.positions[tri[1]], view.positions[tri[2]]);
+    }
+
+    void buildBVH(void){
+        buildLevelBVH(bvh, view.triangles);
+        packBlocks();
+    }
+    void packBlocks(void){
+        packTriangleBlocks(bvh, [this](int i){ return edges(i); }, blocks);
+    }
+    // Builds the BVH of every coarser level whose BVH is missing or was built by another
+    // mode, and collapses the others to the width of bvh; returns the levels built.
+    int buildLevelBVHs(void){
+        int built = 0;
+        for (int l = 1; l < levelCount(); l++) {
+            Level &level = levels[l-1];
+            if (level.bvh.empty() || level.bvh.mode != bvh.mode) {
+                level.bvh.width = bvh.width;
+                level.bvh.mode = bvh.mode;
+                level.bvh.quantized = bvh.quantized;
+                buildLevelBVH(level.bvh, level.view);
+                packTriangleBlocks(level.bvh, [this, l](int i){ return edges(i, l); }, level.blocks);
+                built++;
+            }
+            else if (level.bvh.width != bvh.width || level.bvh.quantized != bvh.quantized) {
+                level.bvh.collapse(bvh.width, bvh.quantized);
+            }
+        }
+        return built;
+    }
+
+private:
+    void buildLevelBVH(BVH &level_bvh, const ArrayView<glm::uvec3> &tris){
+        std::vector<AABB> bounds( tris.size() );
+        for (size_t i = 0; i < bounds.size(); i++) {
+            for (size_t j = 0; j < 3; j++) {
+                bounds[i].grow( view.positions[ tris[i][j] ] );
+            }
+        }
+        level_bvh.leaf_alignment = triangle_block_width;
+        level_bvh.build(bounds);
+    }
 };
 #endif
@@ -10,6 +10,7 @@ A model is a geometry with material.
 struct RTModel {
     RTGeometry* geometry;
     Material* material;
+    MaterialId material_id = 0; // material in RTScene::materials, set when the scene is built
 };
 
 #endif 
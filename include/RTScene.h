@@ -1,5 +1,10 @@
 /**************************************************
-
+RTScene is the one description of the scene: the
+palettes of meshes, materials, models and lights,
+the scene graph and the camera.  Both renderers read
+it; the ray tracing structures (triangle soup or
+instances, and their BVHs) are built from it by
+build(), and Scene draws it with OpenGL.
 *****************************************************/
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -18,7 +23,12 @@
 #include "Light.h"
 #include "RTGeometry.h"
 #include "Material.h"
+#include "Palette.h"
+#include "Arena.h"
 #include "RTModel.h"
+#include "BVH.h"
+#include "TriangleSoup.h"
+#include "ClusterStore.h"
 
 #ifndef __RTSCENE_H__
 #define __RTSCENE_H__
@@ -29,58 +39,165 @@ public:
     std::vector< glm::mat4 > childtransforms;
     std::vector< RTModel* > models;
     std::vector< glm::mat4 > modeltransforms;
+    
+    // Change tracking for RTScene::build().  Set changed after editing a transform
+    // above directly (the setters do it).  Adding, removing or replacing a child
+    // or a model is noticed without it, and makes the next build a full one.
+    bool changed = true;
+    void setChildTransform(size_t i, const glm::mat4 &M){ childtransforms[i] = M; changed = true; }
+    void setModelTransform(size_t i, const glm::mat4 &M){ modeltransforms[i] = M; changed = true; }
+    
+    // childnodes and models as of the last full build
+    std::vector< RTNode* > built_childnodes;
+    std::vector< RTModel* > built_models;
+};
+
+// One visit of the depth-first search over the scene graph: a node reached
+// through one path from the world node (a node with several parents is
+// visited once per path).  Parents are visited before their children.
+struct RTVisit {
+    RTNode* node;
+    int parent;      // visit of the parent, -1 for the world node
+    int child_index; // node is the parent's childnodes[child_index]
+    glm::mat4 M;     // node -> world
+    bool changed;    // M or the model transforms of the node changed in the last build
+};
+
+// The triangles of one model in the triangle soup, in the world coordinate.
+struct RTSoupRange {
+    int visit;       // where the model was found: visits[visit].node -> models[model_index]
+    int model_index;
+    size_t first;    // first triangle in triangle_soup
+};
+
+// An instance is one model reached through the scene graph, together with
+// the transformation that brings it from the model to the world coordinate.
+struct RTInstance {
+    RTModel* model;
+    int visit;       // where the model was found: visits[visit].node -> models[model_index]
+    int model_index;
+    glm::mat4 M;     // model matrix (model -> world)
+    glm::mat4 M_inv; // inverse model matrix (world -> model)
+    glm::mat3 N;     // normal matrix, inverse transpose of the linear block of M
+    float scale;     // largest scale of M, the length of the longest axis it maps
+    AABB box;        // bounding box in the world coordinate
+    
+    void setTransform(const glm::mat4 &model_matrix); // updates M and everything derived from it
 };
 
 class RTScene {
 public:
+    // Owns the camera and every object of the palettes: create them with arena.make<T>(),
+    // and they are all released at once with the scene.
+    Arena arena;
+    // Transient data of one build or one frame of the ray tracer (ray queues, scratch
+    // arrays, DFS stacks); reset when either starts, so its memory is reused frame to frame.
+    Arena frame_arena;
+    
     Camera* camera;
     // The following are containers of objects serving as the object palettes.
     // The containers store pointers so that they can also store derived class objects.
-    std::map< std::string, RTGeometry* > geometry;
-    std::map< std::string, Material* > material;
-    std::map< std::string, RTModel* > model;
-    std::map< std::string, Light* > light;
+    // Names are only looked up while the scene is loaded; the palettes are iterated by index.
+    Palette< RTGeometry > geometry;
+    Palette< Material > material;
+    Palette< RTModel > model;
+    Palette< Light > light;
+    
+    // Dense copy of the material palette that the ray tracer shades with; triangles,
+    // models and hits refer to its entries by MaterialId.  Rebuilt by build() when
+    // materials_changed is set, which has to be done after editing the palette or a model's material.
+    std::vector<Material> materials;
+    bool materials_changed = true;
     
     // The container of nodes will be the scene graph after we connect the nodes by setting the child_nodes.
-    std::map< std::string, RTNode* > node;
+    Palette< RTNode > node;
+    RTNode* world; // root of the scene graph, node["world"]
     
     //triangle soup
-    std::vector<Triangle> triangle_soup;  //list of triangles in the world coordinate
+    TriangleSoup triangle_soup;  //triangles in the world coordinate, split into hot and cold streams
+    std::vector<RTSoupRange> soup_ranges; // the models flattened into triangle_soup, in soup order
+    BVH bvh;    // bounding volume hierarchy over triangle_soup
+    
+    //two-level structure: one BVH per geometry (RTGeometry::bvh) and a top-level BVH over the instances
+    bool instancing = true; // trace instances instead of flattening them into triangle_soup
+    std::vector<RTInstance> instances;
+    BVH tlas;
+    
+    //out-of-core soup: the flattened scene in clusters that are paged in from a file as the
+    //rays reach them, for scenes whose triangle soup does not fit in memory (see ClusterStore)
+    bool out_of_core = false; // trace the clusters instead of the instances or triangle_soup
+    ClusterStore clusters;    // its budget bounds the memory of the paged-in clusters
+    std::string cluster_path = "scene.rtclusters"; // prefix of the unique file the clusters are written to; removed once mapped
+    
+    // branching factor of every BVH in the scene (2, 4 or 8); wide nodes are tested with SSE/AVX
+#if defined(__AVX__)
+    int bvh_width = 8;
+#else
+    int bvh_width = 4;
+#endif
     
     RTScene(){
         // the default scene graph already has one node named "world."
-        node["world"] = new RTNode;
+        world = node["world"] = arena.make<RTNode>();
     }
     
+    // store the wide BVHs with 8-bit quantized child boxes (about half the memory, some extra decoding per node)
+    bool bvh_quantized = false;
+    
+    // builder used for every BVH in the scene
+    BVHBuildMode bvh_mode = BVH_BINNED_SAH;
+    
+    // side of the screen tiles whose primary rays are traced together as a packet (4 or 8); 1 traces every ray alone
+    int packet_size = 8;
+
+    // trace bounce by bounce over the whole frame, with the rays of each bounce sorted, instead of pixel by pixel
+    bool wavefront = false;
+    
+    // level of detail of the meshes that shadow and reflection rays are traced against
+    // (see RTGeometry::levels); 0 is the full mesh.  Only instances have levels: the
+    // triangle soup and the clusters are always flattened from the full meshes.
+    // A coarse level is not the surface the camera rays hit, so the shadow and reflection
+    // rays of a hit ignore their own instance up to the level's error (times the instance's
+    // scale) instead of hitting its coarse surface: the trade-off is that an instance's
+    // shadows and reflections on itself closer than this are lost.  Pushing the rays out
+    // by as much instead would lose them near the other instances, e.g. where it stands.
+    int secondary_lod = 0;
+
+    // A BVH whose primitives only moved is refitted; it is rebuilt once its SAH cost
+    // exceeds refit_threshold times the cost it had when it was last built.
+    float refit_threshold = 1.5f;
+    
+    static const int flatten_chunk_size = 16384; // fewest vertices or triangles a thread flattens
+    static const size_t cluster_batch_size = 1 << 20; // most triangles flattened at once while the clusters are written
+    
     void init( void );
+    void init( const char* path ); // imports the .glb scene at path instead of the built-in one
+    // Builds the clusters, the instances or the triangle soup.  Only what changed since the
+    // last build is redone: nothing for a camera move, and only the models under changed nodes
+    // for new transforms (the clusters are all rewritten then).  The whole scene is rebuilt
+    // when the graph, the materials or the settings above changed.
+    void build( void );
+    void buildMaterialTable( void );
+    size_t buildSoupRanges( void ); // lays out soup_ranges; returns the number of triangles
     void buildTriangleSoup( void );
+    void updateTriangleSoup( void );
+    // writes the triangles of soup_ranges[ranges[k]] into soup, shifted down by soup_first, in parallel
+    void flattenModels( const std::vector<size_t> &ranges, TriangleSoup &soup, size_t soup_first = 0 );
+    bool buildClusters( void ); // false if the cluster file cannot be written (out_of_core is then turned off)
+    void buildInstances( void );
+    void updateInstances( void );
+    void buildLevelBVHs( void ); // of the instanced geometries, for secondary_lod
+    void buildBVH( void );
+    void traverseGraph( void );
+    bool updateVisits( void ); // refreshes M and changed of the visits; false if no node changed
+    AABB bounds( void ); // world box of the models of the visits, from the boxes of their meshes
     
-    // destructor
-    ~RTScene(){
-        // The containers of pointers own the object pointed to by the pointers.
-        // All the objects should be deleted when the object palette is destructed.
-        // light
-        for(std::pair<std::string,Light*> entry : light ){
-            delete entry.second;
-        }
-        // geometry
-        for(std::pair<std::string,RTGeometry*> entry : geometry ){
-            delete entry.second;
-        }
-        // material
-        for(std::pair<std::string,Material*> entry : material ){
-            delete entry.second;
-        }
-        // model
-        for(std::pair<std::string,RTModel*> entry : model ){
-            delete entry.second;
-        }
-        // model
-        for(std::pair<std::string,RTNode*> entry : node ){
-            delete entry.second;
-        }
-        delete camera;
-    }
+    // scene graph as of the last full build
+    std::vector<RTVisit> visits;
+    bool built = false;
+    bool built_instancing = false; // which of the three the last build made
+    bool built_out_of_core = false;
+    void refitOrBuild( BVH &bvh, const std::vector<AABB> &bounds, const char* name );
 };
 
 #endif 
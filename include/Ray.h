@@ -1,8 +1,10 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <vector>
+#include <algorithm>
 #include <limits>
 #include <math.h>
+#include <cmath>
 #include <glm/gtx/string_cast.hpp>
 
 #include "RTScene.h"
@@ -16,13 +18,110 @@ const float MY_INFINITY = 9999999999999999999.9f;
 struct Ray {
     glm::vec3 p0;  // basepoint (position)
     glm::vec3 dir; // direction
+    int lod = 0;   // level of detail of the meshes it is traced against (see RTGeometry::levels)
+    // a secondary ray ignores the hits on the instance it leaves that are closer than origin_gap
+    const RTInstance* origin = NULL;
+    float origin_gap = 0.0f;
+
+    float tmin(const RTInstance* instance) const { return instance == origin && instance != NULL ? origin_gap : 0.0f; }
 };
 
+// Coherent rays (e.g. the primary rays of a screen tile) traced through the
+// BVHs together.  Boxes are tested once for the whole packet, with interval
+// arithmetic over the ray origins and inverse directions; only leaves are
+// tested ray by ray.
+struct RayPacket {
+    static const int max_size = 64; // an 8x8 tile
+    int size = 0;
+    Ray rays[max_size];
+    glm::vec3 inv_dir[max_size];
+    glm::vec3 org_lo, org_hi; // bounds of the ray origins
+    glm::vec3 inv_lo, inv_hi; // bounds of the inverse directions
+    glm::vec3 dir_sum;        // average direction (unnormalized), to order children near to far
+    bool coherent = false;    // every axis has the same nonzero direction sign in all rays
+
+    void update(void){
+        //bounds of the rays; the interval test is only valid if no axis changes sign
+        coherent = size > 0;
+        dir_sum = glm::vec3(0.0f);
+        for (int r = 0; r < size; r++) {
+            inv_dir[r] = 1.0f / rays[r].dir;
+            dir_sum += rays[r].dir;
+            if (r == 0) {
+                org_lo = org_hi = rays[r].p0;
+                inv_lo = inv_hi = inv_dir[r];
+            }
+            else {
+                org_lo = glm::min(org_lo, rays[r].p0);
+                org_hi = glm::max(org_hi, rays[r].p0);
+                inv_lo = glm::min(inv_lo, inv_dir[r]);
+                inv_hi = glm::max(inv_hi, inv_dir[r]);
+            }
+        }
+        for (int a = 0; a < 3 && coherent; a++) {
+            coherent = std::isfinite(inv_lo[a]) && std::isfinite(inv_hi[a]) && (inv_lo[a] > 0.0f || inv_hi[a] < 0.0f);
+        }
+    }
+};
+
+// What the traversal keeps of the closest hit so far: no more than the
+// distance, the barycentrics and which triangle it is.  ResolveHit turns the
+// final one into an Intersection.
+struct HitRecord {
+    TriangleHit hit;
+    int prim = -1;                // triangle hit, -1 for none
+    RTInstance* instance = NULL;  // instance hit, NULL for the triangle soup
+    int cluster = -1;             // cluster of the out-of-core soup hit, -1 otherwise
+
+    bool found(void) const { return prim >= 0; }
+};
+
+// closest hit of every ray of a packet so far
+struct PacketHits {
+    float tmax[RayPacket::max_size];
+    HitRecord record[RayPacket::max_size];
+};
+
+// A ray waiting in a queue of the wavefront renderer, with the pixel its
+// radiance goes to and the weight it is added with.
+struct QueuedRay {
+    Ray ray;
+    glm::vec3 weight; // throughput of the path so far; for a shadow ray, the whole contribution of its light
+    float tmax;       // end of a shadow ray (the light)
+    int pixel;
+};
+// the rays of one pass of the wavefront; they live in the scene's frame arena
+typedef ArenaVector<QueuedRay> RayQueue;
+
 namespace RayTracer {
     void Raytrace(Camera *cam, RTScene &scene, Image &image);
+    void FinishFrame(RTScene &scene);
+    void RaytraceWavefront(Camera *cam, RTScene &scene, Image &image, int recursion_depth);
+    void SortRays(RayQueue &queue, Arena &scratch);
+    void IntersectRays(RayQueue &queue, RTScene &scene, ArenaVector<HitRecord> &records);
     Ray RayThruPixel(Camera *cam, int i, int j, int width, int height);
-    Intersection Intersect(Ray &ray, Triangle &triangle);
+    int IntersectBlocks(Ray &ray, const TriangleBlockArray &blocks, int first, int count, float tmin, float &tmax, TriangleHit &hit);
+    Intersection Interpolate(const Triangle &triangle, const TriangleHit &hit);
+    Intersection ResolveHit(const Ray &ray, const HitRecord &record, RTScene &scene);
+    bool FindClosest(Ray &ray, RTScene &scene, HitRecord &record);
+    bool FindClosest(Ray &ray, const BVH &bvh, const TriangleBlockArray &blocks, HitRecord &record);
     Intersection Intersect(Ray &ray, RTScene &scene);
+    bool Occluded(Ray &ray, RTScene &scene, float tmax);
+    void IntersectPacket(RayPacket &packet, RTScene &scene, PacketHits &closest);
+    void IntersectPacketLeaf(const RayPacket &packet, const TriangleBlockArray &blocks, int first, int count, const AABB &box,
+                             RTInstance *instance, int cluster, PacketHits &closest);
+    bool IntersectAABB(const RayPacket &packet, const AABB &box, float tmax);
+    float IntersectAABB(Ray &ray, glm::vec3 &inv_dir, const AABB &box, float tmax);
+    template <typename LeafTest>
+    void Traverse(Ray &ray, const BVH &bvh, float &tmax, LeafTest leaf_test);
+    template <typename LeafTest>
+    void TraverseBinary(Ray &ray, const BVH &bvh, float &tmax, LeafTest leaf_test);
+    template <typename WideNode, typename LeafTest>
+    void TraverseWide(Ray &ray, const BVH &bvh, const WideNode *nodes, float &tmax, LeafTest leaf_test);
+    template <typename LeafTest>
+    void TraversePacket(const RayPacket &packet, const BVH &bvh, const float *tmax, LeafTest leaf_test);
+    Ray ShadowRay(const Intersection &hit, const Light &light, float &light_dist);
+    Ray ReflectionRay(const Intersection &hit);
     glm::vec3 FindColor(Intersection &hit, RTScene &scene, int recursion_depth);
 };
 
@@ -33,6 +132,43 @@ bool eq_float(float x, float y, float epsilon=0.01f) {
 
 void RayTracer::Raytrace(Camera *cam, RTScene &scene, Image &image) {
     int w = image.width; int h = image.height;
+    // the transient data of the last frame is not needed anymore
+    scene.frame_arena.reset();
+    scene.clusters.beginFrame();
+
+    if (scene.wavefront) {
+        RaytraceWavefront( cam, scene, image, 6 );
+        FinishFrame(scene);
+        return;
+    }
+
+    //primary rays of a tile go through the BVHs as one packet
+    const int tile = scene.packet_size;
+    if (tile > 1 && tile * tile <= RayPacket::max_size) {
+        RayPacket packet;
+        PacketHits closest;
+        for (int j0=0; j0<h; j0+=tile){
+            for (int i0=0; i0<w; i0+=tile){
+                packet.size = 0;
+                for (int j=j0; j<std::min(j0+tile, h); j++){
+                    for (int i=i0; i<std::min(i0+tile, w); i++){
+                        packet.rays[packet.size++] = RayThruPixel( cam, i, j, w, h );
+                    }
+                }
+                packet.update();
+                IntersectPacket( packet, scene, closest );
+                int k = 0;
+                for (int j=j0; j<std::min(j0+tile, h); j++){
+                    for (int i=i0; i<std::min(i0+tile, w); i++, k++){
+                        Intersection hit = ResolveHit( packet.rays[k], closest.record[k], scene );
+                        image.pixels[(h-j-1)*w + i] = FindColor( hit, scene, 6 );
+                    }
+                }
+            }
+        }
+        FinishFrame(scene);
+        return;
+    }
 
      for (int j=0; j<h; j++){
          for (int i=0; i<w; i++){
@@ -41,7 +177,175 @@ void RayTracer::Raytrace(Camera *cam, RTScene &scene, Image &image) {
              image.pixels[(h-j-1)*w + i] = FindColor( hit, scene, 6 );
          }
      }
+    FinishFrame(scene);
+}
+
+void RayTracer::FinishFrame(RTScene &scene) {
     std::cout << "Raytrace finished." << std::endl;
+    if (scene.out_of_core) scene.clusters.printFrameStats();
+}
+
+void RayTracer::RaytraceWavefront(Camera *cam, RTScene &scene, Image &image, int recursion_depth) {
+    //Every bounce of the whole frame is one pass: all the rays of the pass are sorted and
+    //intersected together, then shaded, which queues the shadow rays and the rays of the next bounce.
+    //The colors are the ones of FindColor, summed in another order.
+    int w = image.width; int h = image.height;
+    //the queues are sized once per pass in the frame arena, which is given back as a whole for the next frame
+    Arena &arena = scene.frame_arena;
+    RayQueue queue( (ArenaAllocator<QueuedRay>(arena)) ), next( (ArenaAllocator<QueuedRay>(arena)) ), shadow( (ArenaAllocator<QueuedRay>(arena)) );
+    ArenaVector<HitRecord> records( (ArenaAllocator<HitRecord>(arena)) ); // only the hits are kept for the whole queue; each is resolved when it is shaded
+    //primary rays in 8x8 tiles, so that consecutive rays form the packets of Raytrace
+    queue.reserve(w * h);
+    const int tile = 8;
+    for (int j0=0; j0<h; j0+=tile){
+        for (int i0=0; i0<w; i0+=tile){
+            for (int j=j0; j<std::min(j0+tile, h); j++){
+                for (int i=i0; i<std::min(i0+tile, w); i++){
+                    QueuedRay q;
+                    q.ray = RayThruPixel( cam, i, j, w, h );
+                    q.weight = glm::vec3(1.0f);
+                    q.tmax = MY_INFINITY;
+                    q.pixel = (h-j-1)*w + i;
+                    image.pixels[q.pixel] = glm::vec3(0.0f);
+                    queue.push_back(q);
+                }
+            }
+        }
+    }
+
+    for (int depth = recursion_depth; depth > 0 && !queue.empty(); depth--) {
+        //the primary rays, and the shadow rays of their hits, are in screen tiles already; the bounces scatter
+        if (depth < recursion_depth) SortRays(queue, arena);
+        IntersectRays(queue, scene, records);
+
+        next.clear();
+        shadow.clear();
+        next.reserve(queue.size());
+        shadow.reserve(queue.size() * scene.light.size());
+        for (size_t r = 0; r < queue.size(); r++) {
+            const QueuedRay &q = queue[r];
+            if (!records[r].found()) {
+                //only a primary ray shows the background; a reflection that misses adds nothing
+                if (depth == recursion_depth) image.pixels[q.pixel] += q.weight * glm::vec3(0.1f, 0.2f, 0.3f);
+                continue;
+            }
+            Intersection hit = ResolveHit(q.ray, records[r], scene);
+            const Material &material = scene.materials[hit.material];
+            glm::vec3 color = glm::vec3(material.emision);
+            for ( const Light* light : scene.light ) {
+                glm::vec3 light_color = glm::vec3(light->color);
+                color += light_color * glm::vec3(material.ambient);
+
+                glm::vec3 l_vec = glm::normalize(glm::vec3(light->position) - (light->position)[3]*hit.P);
+                float diffuse = glm::max(glm::dot(hit.N, l_vec), 0.0f);
+                if (diffuse > 0.0f && glm::vec3(material.diffuse) != glm::vec3(0.0f)) {
+                    QueuedRay s;
+                    s.ray = ShadowRay(hit, *light, s.tmax);
+                    s.ray.lod = scene.secondary_lod;
+                    s.weight = q.weight * light_color * glm::vec3(material.diffuse) * diffuse;
+                    s.pixel = q.pixel;
+                    shadow.push_back(s);
+                }
+            }
+            image.pixels[q.pixel] += q.weight * color;
+
+            //FindColor traces the reflection once per light and adds every copy
+            glm::vec3 specular = glm::vec3(material.specular) * float(scene.light.size());
+            if (depth > 1 && specular != glm::vec3(0.0f)) {
+                QueuedRay m;
+                m.ray = ReflectionRay(hit);
+                m.ray.lod = scene.secondary_lod;
+                m.weight = q.weight * specular;
+                m.tmax = MY_INFINITY;
+                m.pixel = q.pixel;
+                next.push_back(m);
+            }
+        }
+
+        if (depth < recursion_depth) SortRays(shadow, arena);
+        for (size_t r = 0; r < shadow.size(); r++) {
+            if (!Occluded(shadow[r].ray, scene, shadow[r].tmax)) image.pixels[shadow[r].pixel] += shadow[r].weight;
+        }
+        queue.swap(next);
+    }
+}
+
+// spreads the lower 10 bits of v so that there are two zero bits between each
+static uint32_t ExpandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void RayTracer::SortRays(RayQueue &queue, Arena &scratch) {
+    //key: the octant of the direction, then the Morton code of the origin (9 bits per axis) within
+    //the bounds of all the origins; rays next to each other in the queue start close together and
+    //point the same way, so they visit the same nodes
+    const int n = int(queue.size());
+    if (n < 2) return;
+    glm::vec3 lo = queue[0].ray.p0, hi = lo;
+    for (int r = 1; r < n; r++) {
+        lo = glm::min(lo, queue[r].ray.p0);
+        hi = glm::max(hi, queue[r].ray.p0);
+    }
+    glm::vec3 extent = hi - lo;
+    glm::vec3 scale;
+    for (int a = 0; a < 3; a++) scale[a] = extent[a] > 0.0f ? 511.0f / extent[a] : 0.0f;
+
+    ArenaVector<uint32_t> keys(n, 0, ArenaAllocator<uint32_t>(scratch)), keys_tmp(n, 0, ArenaAllocator<uint32_t>(scratch));
+    ArenaVector<int> order(n, 0, ArenaAllocator<int>(scratch)), order_tmp(n, 0, ArenaAllocator<int>(scratch));
+    for (int r = 0; r < n; r++) {
+        const Ray &ray = queue[r].ray;
+        glm::vec3 o = glm::clamp((ray.p0 - lo) * scale, glm::vec3(0.0f), glm::vec3(511.0f));
+        uint32_t octant = (ray.dir.x < 0.0f ? 4 : 0) | (ray.dir.y < 0.0f ? 2 : 0) | (ray.dir.z < 0.0f ? 1 : 0);
+        keys[r] = (octant << 27) | (ExpandBits(uint32_t(o.x)) << 2) | (ExpandBits(uint32_t(o.y)) << 1) | ExpandBits(uint32_t(o.z));
+        order[r] = r;
+    }
+
+    //LSD radix sort, 8 bits per pass; it is stable, so rays with the same key keep their order
+    for (int shift = 0; shift < 30; shift += 8) {
+        int histogram[256] = {0};
+        for (int r = 0; r < n; r++) histogram[ (keys[r] >> shift) & 0xFF ]++;
+        int offset = 0;
+        for (int d = 0; d < 256; d++) {
+            int num = histogram[d];
+            histogram[d] = offset;
+            offset += num;
+        }
+        for (int r = 0; r < n; r++) {
+            int dst = histogram[ (keys[r] >> shift) & 0xFF ]++;
+            keys_tmp[dst] = keys[r];
+            order_tmp[dst] = order[r];
+        }
+        keys.swap(keys_tmp);
+        order.swap(order_tmp);
+    }
+
+    RayQueue sorted( (ArenaAllocator<QueuedRay>(scratch)) );
+    sorted.reserve(n);
+    for (int r = 0; r < n; r++) sorted.push_back( queue[ order[r] ] );
+    queue.swap(sorted);
+}
+
+void RayTracer::IntersectRays(RayQueue &queue, RTScene &scene, ArenaVector<HitRecord> &records) {
+    //a sorted queue is cut into packets of consecutive rays; IntersectPacket traces
+    //the ones that do not share the direction signs ray by ray
+    records.resize(queue.size());
+    if (scene.packet_size <= 1) {
+        for (size_t r = 0; r < queue.size(); r++) FindClosest(queue[r].ray, scene, records[r]);
+        return;
+    }
+    RayPacket packet;
+    PacketHits closest;
+    for (size_t first = 0; first < queue.size(); first += RayPacket::max_size) {
+        packet.size = int(std::min(queue.size() - first, size_t(RayPacket::max_size)));
+        for (int r = 0; r < packet.size; r++) packet.rays[r] = queue[first + r].ray;
+        packet.update();
+        IntersectPacket( packet, scene, closest );
+        std::copy(closest.record, closest.record + packet.size, records.begin() + first);
+    }
 }
 
 Ray RayTracer::RayThruPixel(Camera *cam, int i, int j, int width, int height) {
@@ -61,46 +365,478 @@ Ray RayTracer::RayThruPixel(Camera *cam, int i, int j, int width, int height) {
     return ray;
 }
 
-Intersection RayTracer::Intersect(Ray &ray, Triangle &triangle) {
-    //lambda 1,2,3 and t
-    glm::vec4 res = glm::inverse(glm::mat4(
-                                           glm::vec4(triangle.P[0], 1.0f),
-                                           glm::vec4(triangle.P[1], 1.0f),
-                                           glm::vec4(triangle.P[2], 1.0f),
-                                           glm::vec4(-ray.dir, 0.0f)
-                                           )) * glm::vec4(ray.p0, 1.0f);
-    
+int RayTracer::IntersectBlocks(Ray &ray, const TriangleBlockArray &blocks, int first, int count, float tmin, float &tmax, TriangleHit &hit) {
+    //tests the blocks covering the leaf range [first, first+count) of the BVH indices;
+    //returns the triangle of the nearest hit closer than tmax (and shrinks tmax), or -1
+    const int W = triangle_block_width;
+    int nearest = -1;
+    for (int b = first / W; b <= (first + count - 1) / W; b++) {
+        int lane = blocks[b].intersect(ray.p0, ray.dir, tmin, tmax, hit);
+        if (lane >= 0) {
+            tmax = hit.t;
+            nearest = blocks[b].prim[lane];
+        }
+    }
+    return nearest;
+}
+
+Intersection RayTracer::Interpolate(const Triangle &triangle, const TriangleHit &hit) {
+    //surface attributes of the hit; only computed for the closest hit of a ray
+    float w = 1.0f - hit.u - hit.v;
     Intersection intersect;
-    intersect.P = res[0]*triangle.P[0] + res[1]*triangle.P[1] + res[2]*triangle.P[2];
-    intersect.N = glm::normalize(res[0]*triangle.N[0] + res[1]*triangle.N[1] + res[2]*triangle.N[2]);
-    intersect.V = -ray.dir;
-    intersect.triangle = &triangle;
-    //check no intersection hit?
-    if (res[0] < 0 || res[1] < 0 || res[2] < 0 || res[3] < 0) {
-        intersect.dist = MY_INFINITY;
+    intersect.P = w*triangle.P[0] + hit.u*triangle.P[1] + hit.v*triangle.P[2];
+    intersect.N = glm::normalize(w*triangle.N[0] + hit.u*triangle.N[1] + hit.v*triangle.N[2]);
+    intersect.material = triangle.material;
+    intersect.dist = hit.t;
+    return intersect;
+}
+
+float RayTracer::IntersectAABB(Ray &ray, glm::vec3 &inv_dir, const AABB &box, float tmax) {
+    //slab test; returns the entry distance, or MY_INFINITY if the box is missed or lies beyond tmax
+    glm::vec3 t0 = (box.min - ray.p0) * inv_dir;
+    glm::vec3 t1 = (box.max - ray.p0) * inv_dir;
+    glm::vec3 tsmall = glm::min(t0, t1);
+    glm::vec3 tbig = glm::max(t0, t1);
+    float tnear = glm::max(glm::max(tsmall.x, tsmall.y), glm::max(tsmall.z, 0.0f));
+    float tfar = glm::min(glm::min(tbig.x, tbig.y), glm::min(tbig.z, tmax));
+    if (tnear > tfar) return MY_INFINITY;
+    return tnear;
+}
+
+template <typename LeafTest>
+void RayTracer::Traverse(Ray &ray, const BVH &bvh, float &tmax, LeafTest leaf_test) {
+    //leaf_test(first, count) is called for every leaf the ray reaches, with its range of bvh.view.indices; it shrinks tmax on a closer hit,
+    //or sets it negative to end the traversal (any-hit queries)
+    if (bvh.width == 8 && !bvh.view.qnodes8.empty()) TraverseWide(ray, bvh, bvh.view.qnodes8.data, tmax, leaf_test);
+    else if (bvh.width == 8 && !bvh.view.nodes8.empty()) TraverseWide(ray, bvh, bvh.view.nodes8.data, tmax, leaf_test);
+    else if (bvh.width == 4 && !bvh.view.qnodes4.empty()) TraverseWide(ray, bvh, bvh.view.qnodes4.data, tmax, leaf_test);
+    else if (bvh.width == 4 && !bvh.view.nodes4.empty()) TraverseWide(ray, bvh, bvh.view.nodes4.data, tmax, leaf_test);
+    else TraverseBinary(ray, bvh, tmax, leaf_test);
+}
+
+template <typename LeafTest>
+void RayTracer::TraverseBinary(Ray &ray, const BVH &bvh, float &tmax, LeafTest leaf_test) {
+    if (bvh.view.nodes.empty()) return;
+
+    glm::vec3 inv_dir = 1.0f / ray.dir;
+
+    //visit the nearer child first and skip nodes farther than the closest hit
+    int stack[BVH::max_depth];
+    int stack_size = 0;
+    const BVHNode *node = &bvh.view.nodes[0];
+    if (IntersectAABB(ray, inv_dir, node->box, tmax) == MY_INFINITY) return;
+    while (true) {
+        if (node->isLeaf()) {
+            leaf_test(node->left_first, node->count);
+            if (tmax < 0.0f) return;
+        }
+        else {
+            const BVHNode *child1 = &bvh.view.nodes[node->left_first];
+            const BVHNode *child2 = &bvh.view.nodes[node->left_first + 1];
+            float dist1 = IntersectAABB(ray, inv_dir, child1->box, tmax);
+            float dist2 = IntersectAABB(ray, inv_dir, child2->box, tmax);
+            if (dist1 > dist2) {
+                std::swap(dist1, dist2);
+                std::swap(child1, child2);
+            }
+            if (dist1 != MY_INFINITY) {
+                if (dist2 != MY_INFINITY) stack[stack_size++] = int(child2 - &bvh.view.nodes[0]);
+                node = child1;
+                continue;
+            }
+        }
+        //pop the next node that may still contain a closer hit
+        node = NULL;
+        while (stack_size > 0) {
+            const BVHNode *next = &bvh.view.nodes[ stack[--stack_size] ];
+            if (IntersectAABB(ray, inv_dir, next->box, tmax) != MY_INFINITY) {
+                node = next;
+                break;
+            }
+        }
+        if (node == NULL) break;
     }
-    else {
-        intersect.dist = res[3];
+}
+
+template <typename WideNode, typename LeafTest>
+void RayTracer::TraverseWide(Ray &ray, const BVH &bvh, const WideNode *nodes, float &tmax, LeafTest leaf_test) {
+    const int W = WideNode::width;
+    glm::vec3 inv_dir = 1.0f / ray.dir;
+
+    //stack entries are either a wide node (count 0) or a leaf range of bvh.indices (count > 0)
+    struct StackEntry {
+        int child;
+        int count;
+        float dist;
+    };
+    StackEntry stack[W * BVH::max_stack_depth];
+    int stack_size = 0;
+    StackEntry root = {0, 0, 0.0f};
+    stack[stack_size++] = root;
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.dist > tmax) continue; // a closer hit was found since this was pushed
+
+        if (entry.count > 0) {
+            leaf_test(entry.child, entry.count);
+            if (tmax < 0.0f) return;
+            continue;
+        }
+
+        //test all children at once, then push the hit ones far-to-near so the nearest is popped first
+        const WideNode &node = nodes[entry.child];
+        float tnear[W];
+        int mask = node.intersect(ray.p0, inv_dir, tmax, tnear);
+        int first = stack_size;
+        for (int k = 0; k < W; k++) {
+            if (!(mask & (1 << k)) || node.childCount(k) < 0) continue;
+            StackEntry c = {node.child[k], node.childCount(k), tnear[k]};
+            int pos = stack_size++;
+            while (pos > first && stack[pos-1].dist < c.dist) {
+                stack[pos] = stack[pos-1];
+                pos--;
+            }
+            stack[pos] = c;
+        }
     }
-    return intersect;
 }
 
-Intersection RayTracer::Intersect(Ray &ray, RTScene &scene) {
+bool RayTracer::FindClosest(Ray &ray, const BVH &bvh, const TriangleBlockArray &blocks, HitRecord &record) {
     float mindist = MY_INFINITY;
+    record = HitRecord();
+    Traverse(ray, bvh, mindist, [&](int first, int count) {
+        int i = IntersectBlocks(ray, blocks, first, count, 0.0f, mindist, record.hit);
+        if (i >= 0) record.prim = i; // closer than previous hit
+    });
+    return record.found();
+}
 
+bool RayTracer::FindClosest(Ray &ray, RTScene &scene, HitRecord &record) {
+    if (scene.out_of_core) {
+        //a cluster is paged in when the ray reaches its box, then traced like the triangle soup
+        ClusterStore &clusters = scene.clusters;
+        glm::vec3 inv_dir = 1.0f / ray.dir;
+        float mindist = MY_INFINITY;
+        record = HitRecord();
+        Traverse(ray, clusters.bvh, mindist, [&](int first, int count) {
+            for (int k = first; k < first + count; k++) {
+                int c = clusters.bvh.view.indices[k];
+                if (IntersectAABB(ray, inv_dir, clusters.box(c), mindist) == MY_INFINITY) continue;
+                const ClusterPage &page = clusters.acquire(c);
+                Traverse(ray, page.bvh, mindist, [&](int first_tri, int tri_count) {
+                    int j = IntersectBlocks(ray, page.blocks, first_tri, tri_count, 0.0f, mindist, record.hit);
+                    if (j >= 0) {
+                        record.prim = j;
+                        record.cluster = c;
+                    }
+                });
+            }
+        });
+        return record.found();
+    }
+    if (!scene.instancing) {
+        return FindClosest(ray, scene.bvh, scene.triangle_soup.blocks, record);
+    }
+    
+    float mindist = MY_INFINITY;
+    record = HitRecord();
+    Traverse(ray, scene.tlas, mindist, [&](int first, int count) {
+        for (int k = first; k < first + count; k++) {
+            RTInstance &inst = scene.instances[ scene.tlas.view.indices[k] ];
+            RTGeometry *geom = inst.model->geometry;
+            
+            //bring the ray into the model coordinate; the direction is not renormalized so distances stay the same
+            Ray ray_model;
+            ray_model.p0 = glm::vec3(inst.M_inv * glm::vec4(ray.p0, 1.0f));
+            ray_model.dir = glm::mat3(inst.M_inv) * ray.dir;
+            
+            //only look for hits closer than the closest one so far
+            const TriangleBlockArray &blocks = geom->levelBlocks(ray.lod);
+            Traverse(ray_model, geom->levelBVH(ray.lod), mindist, [&](int first_tri, int tri_count) {
+                int j = IntersectBlocks(ray_model, blocks, first_tri, tri_count, ray.tmin(&inst), mindist, record.hit);
+                if (j >= 0) {
+                    record.prim = j;
+                    record.instance = &inst;
+                }
+            });
+        }
+    });
+    return record.found();
+}
+
+Intersection RayTracer::Intersect(Ray &ray, RTScene &scene) {
+    HitRecord record;
+    FindClosest(ray, scene, record);
+    return ResolveHit(ray, record, scene);
+}
+
+bool RayTracer::Occluded(Ray &ray, RTScene &scene, float tmax) {
+    //any-hit query: is there a triangle at 0 <= t < tmax?  Stops at the first one found and computes nothing about it.
+    //The traversals end once limit is set negative.
+    float limit = tmax;
+    if (scene.out_of_core) {
+        ClusterStore &clusters = scene.clusters;
+        glm::vec3 inv_dir = 1.0f / ray.dir;
+        Traverse(ray, clusters.bvh, limit, [&](int first, int count) {
+            for (int k = first; k < first + count && limit >= 0.0f; k++) {
+                int c = clusters.bvh.view.indices[k];
+                if (IntersectAABB(ray, inv_dir, clusters.box(c), tmax) == MY_INFINITY) continue;
+                const ClusterPage &page = clusters.acquire(c);
+                Traverse(ray, page.bvh, limit, [&](int first_tri, int tri_count) {
+                    const int W = triangle_block_width;
+                    for (int b = first_tri / W; b <= (first_tri + tri_count - 1) / W; b++) {
+                        if (page.blocks[b].occludes(ray.p0, ray.dir, 0.0f, tmax)) {
+                            limit = -1.0f;
+                            return;
+                        }
+                    }
+                });
+            }
+        });
+        return limit < 0.0f;
+    }
+    if (!scene.instancing) {
+        Traverse(ray, scene.bvh, limit, [&](int first, int count) {
+            const int W = triangle_block_width;
+            for (int b = first / W; b <= (first + count - 1) / W; b++) {
+                if (scene.triangle_soup.blocks[b].occludes(ray.p0, ray.dir, 0.0f, tmax)) {
+                    limit = -1.0f;
+                    return;
+                }
+            }
+        });
+        return limit < 0.0f;
+    }
+
+    Traverse(ray, scene.tlas, limit, [&](int first, int count) {
+        for (int k = first; k < first + count && limit >= 0.0f; k++) {
+            RTInstance &inst = scene.instances[ scene.tlas.view.indices[k] ];
+            RTGeometry *geom = inst.model->geometry;
+
+            Ray ray_model;
+            ray_model.p0 = glm::vec3(inst.M_inv * glm::vec4(ray.p0, 1.0f));
+            ray_model.dir = glm::mat3(inst.M_inv) * ray.dir;
+
+            const TriangleBlockArray &blocks = geom->levelBlocks(ray.lod);
+            Traverse(ray_model, geom->levelBVH(ray.lod), limit, [&](int first_tri, int tri_count) {
+                const int W = triangle_block_width;
+                for (int b = first_tri / W; b <= (first_tri + tri_count - 1) / W; b++) {
+                    if (blocks[b].occludes(ray_model.p0, ray_model.dir, ray.tmin(&inst), tmax)) {
+                        limit = -1.0f;
+                        return;
+                    }
+                }
+            });
+        }
+    });
+    return limit < 0.0f;
+}
+
+Intersection RayTracer::ResolveHit(const Ray &ray, const HitRecord &record, RTScene &scene) {
+    //surface attributes of the closest hit, computed once after the traversal
     Intersection hit;
-    hit.dist = mindist;
-    for (Triangle &object : scene.triangle_soup) { // Find closest intersection; test all objects
-        Intersection hit_temp = Intersect(ray, object);
-                
-        if (hit_temp.dist < mindist) { // closer than previous hit
-            mindist = hit_temp.dist;
-            hit = hit_temp;
+    if (!record.found()) {
+        hit.dist = MY_INFINITY;
+        return hit;
+    }
+    if (record.cluster >= 0) { //read from the cluster file, whether or not the cluster is still paged in
+        hit = Interpolate(scene.clusters.triangle(record.cluster, record.prim), record.hit);
+    }
+    else if (record.instance == NULL) {
+        hit = Interpolate(scene.triangle_soup.triangle(record.prim), record.hit);
+    }
+    else { // the hit was found in the model coordinate; bring it back to the world coordinate
+        hit = Interpolate(record.instance->model->geometry->triangle(record.prim, ray.lod), record.hit);
+        hit.P = ray.p0 + hit.dist * ray.dir;
+        hit.N = glm::normalize(record.instance->N * hit.N);
+        hit.material = record.instance->model->material_id;
+        hit.instance = record.instance;
+        //the level the secondary rays see of this instance is up to the error of either level away from the hit
+        if (ray.lod != scene.secondary_lod) {
+            const RTGeometry* geom = record.instance->model->geometry;
+            hit.lod_gap = record.instance->scale * (geom->levelError(ray.lod) + geom->levelError(scene.secondary_lod));
         }
     }
+    hit.V = -ray.dir;
     return hit;
 }
 
+bool RayTracer::IntersectAABB(const RayPacket &packet, const AABB &box, float tmax) {
+    //interval slab test: a lower bound of the entry and an upper bound of the exit distance over all rays;
+    //false means that no ray of the packet hits the box before tmax
+    float tnear = 0.0f;
+    float tfar = tmax;
+    for (int a = 0; a < 3; a++) {
+        float near_plane = packet.inv_lo[a] > 0.0f ? box.min[a] : box.max[a];
+        float far_plane = packet.inv_lo[a] > 0.0f ? box.max[a] : box.min[a];
+        float n0 = (near_plane - packet.org_hi[a]) * packet.inv_lo[a], n1 = (near_plane - packet.org_hi[a]) * packet.inv_hi[a];
+        float n2 = (near_plane - packet.org_lo[a]) * packet.inv_lo[a], n3 = (near_plane - packet.org_lo[a]) * packet.inv_hi[a];
+        float f0 = (far_plane - packet.org_hi[a]) * packet.inv_lo[a], f1 = (far_plane - packet.org_hi[a]) * packet.inv_hi[a];
+        float f2 = (far_plane - packet.org_lo[a]) * packet.inv_lo[a], f3 = (far_plane - packet.org_lo[a]) * packet.inv_hi[a];
+        tnear = std::max(tnear, std::min(std::min(n0, n1), std::min(n2, n3)));
+        tfar = std::min(tfar, std::max(std::max(f0, f1), std::max(f2, f3)));
+    }
+    return tnear <= tfar;
+}
+
+template <typename LeafTest>
+void RayTracer::TraversePacket(const RayPacket &packet, const BVH &bvh, const float *tmax, LeafTest leaf_test) {
+    //leaf_test(first, count, box) is called for every leaf that some ray of the packet may reach; it shrinks tmax[]
+    if (bvh.view.nodes.empty()) return;
+    float packet_tmax = 0.0f;
+    for (int r = 0; r < packet.size; r++) packet_tmax = std::max(packet_tmax, tmax[r]);
+
+    int stack[BVH::max_depth];
+    int stack_size = 0;
+    const BVHNode *node = &bvh.view.nodes[0];
+    if (!IntersectAABB(packet, node->box, packet_tmax)) return;
+    while (true) {
+        if (node->isLeaf()) {
+            leaf_test(node->left_first, node->count, node->box);
+            packet_tmax = 0.0f;
+            for (int r = 0; r < packet.size; r++) packet_tmax = std::max(packet_tmax, tmax[r]);
+        }
+        else {
+            //visit the child that is nearer along the packet direction first
+            const BVHNode *child1 = &bvh.view.nodes[node->left_first];
+            const BVHNode *child2 = &bvh.view.nodes[node->left_first + 1];
+            if (glm::dot(child1->box.centroid() - child2->box.centroid(), packet.dir_sum) > 0.0f) std::swap(child1, child2);
+            bool hit1 = IntersectAABB(packet, child1->box, packet_tmax);
+            bool hit2 = IntersectAABB(packet, child2->box, packet_tmax);
+            if (hit1 || hit2) {
+                if (hit1 && hit2) stack[stack_size++] = int(child2 - &bvh.view.nodes[0]);
+                node = hit1 ? child1 : child2;
+                continue;
+            }
+        }
+        //pop the next node that some ray may still hit closer than its closest hit
+        node = NULL;
+        while (stack_size > 0) {
+            const BVHNode *next = &bvh.view.nodes[ stack[--stack_size] ];
+            if (IntersectAABB(packet, next->box, packet_tmax)) {
+                node = next;
+                break;
+            }
+        }
+        if (node == NULL) break;
+    }
+}
+
+void RayTracer::IntersectPacketLeaf(const RayPacket &packet, const TriangleBlockArray &blocks, int first, int count, const AABB &box,
+                                    RTInstance *instance, int cluster, PacketHits &closest) {
+    //the leaf box is tested ray by ray before the triangles
+    for (int r = 0; r < packet.size; r++) {
+        glm::vec3 inv_dir = packet.inv_dir[r];
+        Ray ray = packet.rays[r];
+        if (IntersectAABB(ray, inv_dir, box, closest.tmax[r]) == MY_INFINITY) continue;
+        int j = IntersectBlocks(ray, blocks, first, count, ray.tmin(instance), closest.tmax[r], closest.record[r].hit);
+        if (j >= 0) {
+            closest.record[r].prim = j;
+            closest.record[r].instance = instance;
+            closest.record[r].cluster = cluster;
+        }
+    }
+}
+
+void RayTracer::IntersectPacket(RayPacket &packet, RTScene &scene, PacketHits &closest) {
+    //rays whose directions diverge cannot be bounded by intervals; trace them one by one
+    if (!packet.coherent) {
+        for (int r = 0; r < packet.size; r++) FindClosest(packet.rays[r], scene, closest.record[r]);
+        return;
+    }
+
+    for (int r = 0; r < packet.size; r++) {
+        closest.tmax[r] = MY_INFINITY;
+        closest.record[r] = HitRecord();
+    }
+
+    if (scene.out_of_core) {
+        ClusterStore &clusters = scene.clusters;
+        TraversePacket(packet, clusters.bvh, closest.tmax, [&](int first, int count, const AABB &box) {
+            for (int k = first; k < first + count; k++) {
+                int c = clusters.bvh.view.indices[k];
+                float packet_tmax = *std::max_element(closest.tmax, closest.tmax + packet.size);
+                if (!IntersectAABB(packet, clusters.box(c), packet_tmax)) continue;
+                const ClusterPage &page = clusters.acquire(c);
+                TraversePacket(packet, page.bvh, closest.tmax, [&](int first_tri, int tri_count, const AABB &tri_box) {
+                    IntersectPacketLeaf(packet, page.blocks, first_tri, tri_count, tri_box, NULL, c, closest);
+                });
+            }
+        });
+    }
+    else if (!scene.instancing) {
+        TraversePacket(packet, scene.bvh, closest.tmax, [&](int first, int count, const AABB &box) {
+            IntersectPacketLeaf(packet, scene.triangle_soup.blocks, first, count, box, NULL, -1, closest);
+        });
+    }
+    else {
+        RayPacket packet_model;
+        const int lod = packet.rays[0].lod; //the rays of a packet are of the same pass, so of the same level
+        TraversePacket(packet, scene.tlas, closest.tmax, [&](int first, int count, const AABB &box) {
+            for (int k = first; k < first + count; k++) {
+                RTInstance &inst = scene.instances[ scene.tlas.view.indices[k] ];
+                RTGeometry *geom = inst.model->geometry;
+                const BVH &geom_bvh = geom->levelBVH(lod);
+                const TriangleBlockArray &blocks = geom->levelBlocks(lod);
+
+                //bring the packet into the model coordinate, as in Intersect(ray, scene)
+                glm::mat3 M_inv3 = glm::mat3(inst.M_inv);
+                packet_model.size = packet.size;
+                for (int r = 0; r < packet.size; r++) {
+                    packet_model.rays[r] = packet.rays[r];
+                    packet_model.rays[r].p0 = glm::vec3(inst.M_inv * glm::vec4(packet.rays[r].p0, 1.0f));
+                    packet_model.rays[r].dir = M_inv3 * packet.rays[r].dir;
+                }
+                packet_model.update();
+
+                if (packet_model.coherent) {
+                    TraversePacket(packet_model, geom_bvh, closest.tmax, [&](int first_tri, int tri_count, const AABB &tri_box) {
+                        IntersectPacketLeaf(packet_model, blocks, first_tri, tri_count, tri_box, &inst, -1, closest);
+                    });
+                    continue;
+                }
+                //the transform made the packet diverge
+                for (int r = 0; r < packet.size; r++) {
+                    Traverse(packet_model.rays[r], geom_bvh, closest.tmax[r], [&](int first_tri, int tri_count) {
+                        int j = IntersectBlocks(packet_model.rays[r], blocks, first_tri, tri_count, packet_model.rays[r].tmin(&inst), closest.tmax[r], closest.record[r].hit);
+                        if (j >= 0) {
+                            closest.record[r].prim = j;
+                            closest.record[r].instance = &inst;
+                        }
+                    });
+                }
+            }
+        });
+    }
+}
+
+Ray RayTracer::ShadowRay(const Intersection &hit, const Light &light, float &light_dist) {
+    Ray shadowray;
+    shadowray.p0 = hit.P + 0.01f * hit.N;   //jitter hit pos along unit normal of hit triangle
+    shadowray.origin = hit.instance;
+    shadowray.origin_gap = hit.lod_gap;
+    //a point light (w != 0) only has blockers up to its distance; a directional light (w = 0) is infinitely far in the direction xyz
+    light_dist = MY_INFINITY;
+    if (light.position[3] == 0.0f) {
+        shadowray.dir = glm::normalize(glm::vec3(light.position));
+    }
+    else {
+        glm::vec3 to_light = glm::vec3(light.position) / light.position[3] - shadowray.p0;
+        light_dist = glm::length(to_light);
+        shadowray.dir = to_light / light_dist;
+    }
+    return shadowray;
+}
+
+Ray RayTracer::ReflectionRay(const Intersection &hit) {
+    Ray ray2;
+    ray2.p0 = hit.P + 0.01f * hit.N;    //jitter hit pos along unit normal of hit triangle
+    ray2.origin = hit.instance;
+    ray2.origin_gap = hit.lod_gap;
+    ray2.dir = glm::normalize(2.0f*glm::dot(hit.N, hit.V)*hit.N - hit.V);   //mirror reflection direction
+    return ray2;
+}
+
 glm::vec3 RayTracer::FindColor(Intersection &hit, RTScene &scene, int recursion_depth) {
     //recursion base case
     if (recursion_depth <= 0) {
@@ -114,51 +850,46 @@ glm::vec3 RayTracer::FindColor(Intersection &hit, RTScene &scene, int recursion_
     }
 
     //add light on intersection hit
-    glm::vec3 fragColor = glm::vec3(hit.triangle->material->emision);
+    const Material &material = scene.materials[hit.material];
+    glm::vec3 fragColor = glm::vec3(material.emision);
 
-    for ( std::pair<std::string, Light*> light : scene.light ) {
-        glm::vec3 l_vec = glm::normalize(glm::vec3(((light.second)->position)[0],
-                                              ((light.second)->position)[1],
-                                              ((light.second)->position)[2])
-                                    - ((light.second)->position)[3]*hit.P);
+    for ( const Light* light : scene.light ) {
+        glm::vec3 l_vec = glm::normalize(glm::vec3((light->position)[0],
+                                              (light->position)[1],
+                                              (light->position)[2])
+                                    - (light->position)[3]*hit.P);
 
         glm::vec3 half_vec = glm::normalize(hit.V + l_vec);
 
         //SHADOWS
         //generate secondary rays to all lights, add shadow when there is hit btwn light source and a scene object
         float visible = 1.0f;
-        Ray shadowray;
-        shadowray.p0 = hit.P + 0.01f * hit.N;   //jitter hit pos along unit normal of hit triangle
-        shadowray.dir = glm::normalize(glm::vec3(((light.second)->position)[0],
-                                           ((light.second)->position)[1],
-                                           ((light.second)->position)[2]) - shadowray.p0);
+        float light_dist;
+        Ray shadowray = ShadowRay(hit, *light, light_dist);
+        shadowray.lod = scene.secondary_lod;
         //obstructed by a scene object (towards light)
-        Intersection shadowhit = Intersect(shadowray, scene);
-        if (!(fabs(shadowhit.dist-MY_INFINITY) < 0.1f)) {
+        if (Occluded(shadowray, scene, light_dist)) {
             visible = 0.0f;
         }
 
-        fragColor += glm::vec3((light.second)->color *   //light source color
-                      (hit.triangle->material->ambient +    //ambient
-                       (hit.triangle->material->diffuse)*glm::max(glm::dot(hit.N, l_vec),0.0f)*visible) //diffuse
+        fragColor += glm::vec3(light->color *   //light source color
+                      (material.ambient +    //ambient
+                       (material.diffuse)*glm::max(glm::dot(hit.N, l_vec),0.0f)*visible) //diffuse
                         );
 
         //RECURSIVE MIRROR REFLECTION
         //generate mirror-reflected ray
-        Ray ray2;
-        ray2.p0 = hit.P + 0.01f * hit.N;    //jitter hit pos along unit normal of hit triangle
-//        ray2.p0 = hit.P + 0.0001f * hit.N;    //jitter hit pos along unit normal of hit triangle
-//        ray2.p0 = hit.P + 0.00000000001f * hit.N;    //jitter hit pos along unit normal of hit triangle
-        ray2.dir = glm::normalize(2.0f*glm::dot(hit.N, hit.V)*hit.N - hit.V);   //mirror reflection direction
+        Ray ray2 = ReflectionRay(hit);
+        ray2.lod = scene.secondary_lod;
 
         Intersection hit2 = Intersect( ray2, scene );
 
         //hit2 hits a scene object
         if (!(fabs(hit2.dist-MY_INFINITY) < 0.1f)) {
-            fragColor += (glm::vec3(hit.triangle->material->specular) * FindColor( hit2, scene, recursion_depth-1 ));
+            fragColor += (glm::vec3(material.specular) * FindColor( hit2, scene, recursion_depth-1 ));
         }
 //        else {
-////            fragColor += (glm::vec3(hit.triangle->material->specular) * glm::vec3((light.second)->color));
+////            fragColor += (glm::vec3(material.specular) * glm::vec3(light->color));
 //            return glm::vec3(0.0f,1.0f,0.0f);   //green
 //        }
     }
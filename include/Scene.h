@@ -1,85 +1,48 @@
 /**************************************************
-
+Scene draws an RTScene with OpenGL.  It holds no
+scene data of its own: the meshes of the RTScene are
+uploaded once into GL buffers, and its graph,
+materials, lights and camera are read every frame,
+so both render modes always show the same scene.
+Every model is drawn at the coarsest level of detail
+of its mesh whose error covers at most lod_pixel_error
+pixels on the screen.
 *****************************************************/
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
-#include <glm/gtx/transform.hpp>
-#include <glm/gtx/rotate_normalized_axis.hpp>
 #include <math.h>
 
 #include <stdlib.h>
 #include <vector>
-#include <string>
-#include <map>
+#include <unordered_map>
 #include <stack>
 
-#include "Camera.h"
 #include "SurfaceShader.h"
-#include "Light.h"
 #include "Geometry.h"
-#include "Material.h"
-#include "Model.h"
+#include "RTScene.h"
+#include "Arena.h"
 
 #ifndef __SCENE_H__
 #define __SCENE_H__
 
-class Node {
-public:
-    std::vector< Node* > childnodes;
-    std::vector< glm::mat4 > childtransforms;
-    std::vector< Model* > models;
-    std::vector< glm::mat4 > modeltransforms;
-};
-
 class Scene {
 public:
-    Camera* camera;
-    SurfaceShader* shader;
-    // The following are containers of objects serving as the object palettes.
-    // The containers store pointers so that they can also store derived class objects.
-    std::map< std::string, Geometry* > geometry;
-    std::map< std::string, Material* > material;
-    std::map< std::string, Model* > model;
-    std::map< std::string, Light* > light;
-    
-    // The container of nodes will be the scene graph after we connect the nodes by setting the child_nodes.
-    std::map< std::string, Node* > node;
-    
-    Scene(){
-        // the default scene graph already has one node named "world."
-        node["world"] = new Node;
-    }
-    
-    void init( void );
+    RTScene* source = NULL; // the scene that is drawn
+    SurfaceShader* shader = NULL;
+    // GL buffers of every mesh in source's geometry palette
+    std::unordered_map< const RTGeometry*, Geometry > buffers;
+    // DFS stacks of the frame being drawn; reset at the start of every draw
+    Arena frame_arena;
+    // largest error, in pixels, of the level of detail a model is drawn at; 0 draws the full meshes
+    float lod_pixel_error = 1.0f;
+
+    void init( RTScene* scene );
     void draw( void );
-    
+
     // destructor
     ~Scene(){
-        // The containers of pointers own the object pointed to by the pointers.
-        // All the objects should be deleted when the object palette is destructed.
-        // light
-        for(std::pair<std::string,Light*> entry : light ){
-            delete entry.second;
-        }
-        // geometry
-        for(std::pair<std::string,Geometry*> entry : geometry ){
-            delete entry.second;
-        }
-        // material
-        for(std::pair<std::string,Material*> entry : material ){
-            delete entry.second;
-        }
-        // model
-        for(std::pair<std::string,Model*> entry : model ){
-            delete entry.second;
-        }
-        // model
-        for(std::pair<std::string,Node*> entry : node ){
-            delete entry.second;
-        }
-        delete camera;
         delete shader;
     }
 };
 
-#endif 
+#endif
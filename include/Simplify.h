@@ -0,0 +1,40 @@
+/**************************************************
+Simplify makes the coarser levels of detail of an
+indexed mesh with quadric error metrics (Garland and
+Heckbert): every vertex carries the sum of the squared
+distances to the planes of its triangles, and the
+edges whose collapse adds the least of it are
+collapsed first, until the level has about half the
+triangles of the one before.
+
+A vertex is collapsed onto the other end of its edge
+rather than onto a new position, so every level only
+selects triangles over the vertex arrays of the full
+mesh.  Vertices at the same position (split by their
+normals) move together, so seams do not open; open
+borders are kept in place by extra planes, and a
+collapse that would flip a triangle is skipped.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <vector>
+#include "ArrayView.h"
+
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+namespace Simplify {
+    // one level of detail: triangles over the vertices of the full mesh
+    struct Level {
+        std::vector<glm::uvec3> triangles;
+        float error = 0.0f; // how far the surface moved from the full mesh (an estimate from the quadrics), in model units
+    };
+
+    // Levels 1, 2, ... of the mesh, each with about half the triangles of the one
+    // before.  The chain ends before a level would have fewer than min_triangles,
+    // after max_levels, or when the mesh cannot be simplified any further.
+    std::vector<Level> buildLevels(const ArrayView<glm::vec3> &positions, const ArrayView<glm::vec3> &normals,
+                                   const ArrayView<glm::uvec3> &triangles, size_t min_triangles, int max_levels);
+}
+
+#endif
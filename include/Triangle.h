@@ -5,9 +5,24 @@
 #ifndef __TRIANGLE_H__
 #define __TRIANGLE_H__
 
+// A triangle that carries its own vertices, e.g. one of the triangle soup
+// in the world coordinate.  Models keep indexed meshes instead (see
+// RTGeometry) and only materialize the triangles they are asked for.
 struct Triangle {
-    std::vector<glm::vec3> P; // 3 positions
-    std::vector<glm::vec3> N; // 3 normals
-    Material* material = NULL;
+    glm::vec3 P[3]; // 3 positions
+    glm::vec3 N[3]; // 3 normals
+    MaterialId material = 0; // index in RTScene::materials
+};
+
+// A triangle as one vertex and two edges, precomputed once so the
+// ray-triangle test (Moller-Trumbore) has no per-test setup left.
+struct TriangleEdges {
+    glm::vec3 v0;
+    glm::vec3 e1; // P[1] - P[0]
+    glm::vec3 e2; // P[2] - P[0]
+
+    TriangleEdges(){}
+    TriangleEdges(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2) : v0(p0), e1(p1 - p0), e2(p2 - p0) {}
+    TriangleEdges(const Triangle &t) : v0(t.P[0]), e1(t.P[1] - t.P[0]), e2(t.P[2] - t.P[0]) {}
 };
 #endif
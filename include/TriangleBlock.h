@@ -0,0 +1,247 @@
+/**************************************************
+TriangleBlock packs W triangles in structure-of-
+arrays form (one array per vertex/edge component),
+so that a ray is tested against all of them in one
+SSE (W = 4) or AVX (W = 8) batch.
+
+The blocks of a mesh follow the primitive indices of
+its BVH, which is built with leaf_alignment = W, so a
+leaf is tested by the block (or the few blocks) that
+cover its index range.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include <stdint.h>
+#include "Triangle.h"
+#include "BVH.h"
+#include "AlignedAllocator.h"
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#ifndef __TRIANGLEBLOCK_H__
+#define __TRIANGLEBLOCK_H__
+
+// where a ray hits a triangle: P = (1-u-v)*P[0] + u*P[1] + v*P[2] = p0 + t*dir
+struct TriangleHit {
+    float t;
+    float u;
+    float v;
+};
+
+template <int W>
+struct alignas(32) TriangleBlock {
+    static const int width = W;
+    float v0x[W], v0y[W], v0z[W];
+    float e1x[W], e1y[W], e1z[W]; // P[1] - P[0]
+    float e2x[W], e2y[W], e2z[W]; // P[2] - P[0]
+    int32_t prim[W]; // triangle in each lane; -1 for an empty lane, whose zero edges never hit
+
+    TriangleBlock(){
+        for (int k = 0; k < W; k++) {
+            v0x[k] = v0y[k] = v0z[k] = 0.0f;
+            e1x[k] = e1y[k] = e1z[k] = 0.0f;
+            e2x[k] = e2y[k] = e2z[k] = 0.0f;
+            prim[k] = -1;
+        }
+    }
+
+    void setLane(int k, const TriangleEdges &tri, int prim_idx){
+        v0x[k] = tri.v0.x; v0y[k] = tri.v0.y; v0z[k] = tri.v0.z;
+        e1x[k] = tri.e1.x; e1y[k] = tri.e1.y; e1z[k] = tri.e1.z;
+        e2x[k] = tri.e2.x; e2y[k] = tri.e2.y; e2z[k] = tri.e2.z;
+        prim[k] = prim_idx;
+    }
+
+    // Moller-Trumbore on every lane; returns the lane of the nearest hit with
+    // tmin <= t < tmax (the lowest lane on a tie), or -1 if there is none.
+    int intersect(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax, TriangleHit &hit) const {
+        int nearest = -1;
+        for (int k = 0; k < W; k++) {
+            glm::vec3 e1(e1x[k], e1y[k], e1z[k]), e2(e2x[k], e2y[k], e2z[k]);
+            glm::vec3 pvec = glm::cross(dir, e2);
+            float det = glm::dot(e1, pvec);
+            if (det == 0.0f) continue; // parallel to the triangle plane, or an empty lane
+            float inv_det = 1.0f / det;
+            glm::vec3 tvec = org - glm::vec3(v0x[k], v0y[k], v0z[k]);
+            float u = glm::dot(tvec, pvec) * inv_det;
+            if (!(u >= 0.0f && u <= 1.0f)) continue;
+            glm::vec3 qvec = glm::cross(tvec, e1);
+            float v = glm::dot(dir, qvec) * inv_det;
+            if (!(v >= 0.0f && u + v <= 1.0f)) continue;
+            float t = glm::dot(e2, qvec) * inv_det;
+            if (!(t >= tmin && t < tmax)) continue;
+            tmax = t;
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            nearest = k;
+        }
+        return nearest;
+    }
+
+    // whether any lane is hit with tmin <= t < tmax
+    bool occludes(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax) const {
+        TriangleHit hit;
+        return intersect(org, dir, tmin, tmax, hit) >= 0;
+    }
+};
+
+#if defined(__SSE2__)
+// Moller-Trumbore on the 4 lanes of a block; returns the mask of the lanes hit with tmin <= t < tmax
+static inline __m128 intersectLanes(const TriangleBlock<4> &block, const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax,
+                                    __m128 &t, __m128 &u, __m128 &v){
+    const float *v0x = block.v0x, *v0y = block.v0y, *v0z = block.v0z;
+    const float *e1x = block.e1x, *e1y = block.e1y, *e1z = block.e1z;
+    const float *e2x = block.e2x, *e2y = block.e2y, *e2z = block.e2z;
+    const __m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+    const __m128 ax = _mm_load_ps(e1x), ay = _mm_load_ps(e1y), az = _mm_load_ps(e1z);
+    const __m128 bx = _mm_load_ps(e2x), by = _mm_load_ps(e2y), bz = _mm_load_ps(e2z);
+
+    // pvec = dir x e2, det = e1 . pvec
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, bz), _mm_mul_ps(by, dz));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, bx), _mm_mul_ps(bz, dx));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, by), _mm_mul_ps(bx, dy));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, px), _mm_mul_ps(ay, py)), _mm_mul_ps(az, pz));
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // tvec = org - v0, qvec = tvec x e1
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(org.x), _mm_load_ps(v0x));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(org.y), _mm_load_ps(v0y));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(org.z), _mm_load_ps(v0z));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, az), _mm_mul_ps(ay, tz));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, ax), _mm_mul_ps(az, tx));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, ay), _mm_mul_ps(ax, ty));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, qx), _mm_mul_ps(by, qy)), _mm_mul_ps(bz, qz)), inv_det);
+
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 valid = _mm_cmpneq_ps(det, zero);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tmin)), _mm_cmplt_ps(t, _mm_set1_ps(tmax))));
+    return valid;
+}
+
+template <>
+inline int TriangleBlock<4>::intersect(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax, TriangleHit &hit) const {
+    __m128 t, u, v;
+    __m128 valid = intersectLanes(*this, org, dir, tmin, tmax, t, u, v);
+    if (_mm_movemask_ps(valid) == 0) return -1;
+
+    // nearest valid lane
+    __m128 tv = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+    __m128 tmin4 = _mm_min_ps(tv, _mm_shuffle_ps(tv, tv, _MM_SHUFFLE(2, 3, 0, 1)));
+    tmin4 = _mm_min_ps(tmin4, _mm_shuffle_ps(tmin4, tmin4, _MM_SHUFFLE(1, 0, 3, 2)));
+    int lane = __builtin_ctz( _mm_movemask_ps( _mm_and_ps(valid, _mm_cmpeq_ps(tv, tmin4)) ) );
+
+    alignas(16) float ts[4], us[4], vs[4];
+    _mm_store_ps(ts, t);
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    hit.t = ts[lane];
+    hit.u = us[lane];
+    hit.v = vs[lane];
+    return lane;
+}
+
+template <>
+inline bool TriangleBlock<4>::occludes(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax) const {
+    __m128 t, u, v;
+    return _mm_movemask_ps( intersectLanes(*this, org, dir, tmin, tmax, t, u, v) ) != 0;
+}
+#endif
+
+#if defined(__AVX__)
+// Moller-Trumbore on the 8 lanes of a block; returns the mask of the lanes hit with tmin <= t < tmax
+static inline __m256 intersectLanes(const TriangleBlock<8> &block, const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax,
+                                    __m256 &t, __m256 &u, __m256 &v){
+    const float *v0x = block.v0x, *v0y = block.v0y, *v0z = block.v0z;
+    const float *e1x = block.e1x, *e1y = block.e1y, *e1z = block.e1z;
+    const float *e2x = block.e2x, *e2y = block.e2y, *e2z = block.e2z;
+    const __m256 dx = _mm256_set1_ps(dir.x), dy = _mm256_set1_ps(dir.y), dz = _mm256_set1_ps(dir.z);
+    const __m256 ax = _mm256_load_ps(e1x), ay = _mm256_load_ps(e1y), az = _mm256_load_ps(e1z);
+    const __m256 bx = _mm256_load_ps(e2x), by = _mm256_load_ps(e2y), bz = _mm256_load_ps(e2z);
+
+    // pvec = dir x e2, det = e1 . pvec
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, bz), _mm256_mul_ps(by, dz));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, bx), _mm256_mul_ps(bz, dx));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, by), _mm256_mul_ps(bx, dy));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, px), _mm256_mul_ps(ay, py)), _mm256_mul_ps(az, pz));
+    __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // tvec = org - v0, qvec = tvec x e1
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(org.x), _mm256_load_ps(v0x));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(org.y), _mm256_load_ps(v0y));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(org.z), _mm256_load_ps(v0z));
+    u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, az), _mm256_mul_ps(ay, tz));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, ax), _mm256_mul_ps(az, tx));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, ay), _mm256_mul_ps(ax, ty));
+    v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+    t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(bx, qx), _mm256_mul_ps(by, qy)), _mm256_mul_ps(bz, qz)), inv_det);
+
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    __m256 valid = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tmin), _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ)));
+    return valid;
+}
+
+template <>
+inline int TriangleBlock<8>::intersect(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax, TriangleHit &hit) const {
+    __m256 t, u, v;
+    __m256 valid = intersectLanes(*this, org, dir, tmin, tmax, t, u, v);
+    if (_mm256_movemask_ps(valid) == 0) return -1;
+
+    // nearest valid lane
+    __m256 tv = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), t, valid);
+    __m256 tmin8 = _mm256_min_ps(tv, _mm256_permute_ps(tv, _MM_SHUFFLE(2, 3, 0, 1)));
+    tmin8 = _mm256_min_ps(tmin8, _mm256_permute_ps(tmin8, _MM_SHUFFLE(1, 0, 3, 2)));
+    tmin8 = _mm256_min_ps(tmin8, _mm256_permute2f128_ps(tmin8, tmin8, 1));
+    int lane = __builtin_ctz( _mm256_movemask_ps( _mm256_and_ps(valid, _mm256_cmp_ps(tv, tmin8, _CMP_EQ_OQ)) ) );
+
+    alignas(32) float ts[8], us[8], vs[8];
+    _mm256_store_ps(ts, t);
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+    hit.t = ts[lane];
+    hit.u = us[lane];
+    hit.v = vs[lane];
+    return lane;
+}
+
+template <>
+inline bool TriangleBlock<8>::occludes(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float tmax) const {
+    __m256 t, u, v;
+    return _mm256_movemask_ps( intersectLanes(*this, org, dir, tmin, tmax, t, u, v) ) != 0;
+}
+#endif
+
+// width of the triangle blocks (and of the BVH leaves over triangles)
+#if defined(__AVX__)
+const int triangle_block_width = 8;
+#else
+const int triangle_block_width = 4;
+#endif
+
+typedef std::vector< TriangleBlock<triangle_block_width>, AlignedAllocator< TriangleBlock<triangle_block_width> > > TriangleBlockArray;
+
+// packs triangles in the order of bvh.view.indices, so block b holds indices[b*W, b*W+W);
+// edges(i) returns the TriangleEdges of primitive i
+template <typename Edges>
+inline void packTriangleBlocks(const BVH &bvh, Edges edges, TriangleBlockArray &blocks){
+    const int W = triangle_block_width;
+    const size_t n = bvh.view.indices.size();
+    blocks.assign( (n + W - 1) / W, TriangleBlock<W>() );
+    for (size_t i = 0; i < n; i++) {
+        int prim_idx = bvh.view.indices[i];
+        if (prim_idx >= 0) blocks[i / W].setLane(int(i % W), edges(prim_idx), prim_idx);
+    }
+}
+
+#endif
@@ -0,0 +1,70 @@
+/**************************************************
+TriangleSoup stores the world-space triangles of a
+flattened scene as separate streams, split by how
+often the ray tracer touches them: the hot stream is
+what every ray-triangle test reads (the triangles
+packed into SIMD blocks in BVH order); positions,
+normals and materials are cold and only read to
+build the BVH or to resolve the final hit of a ray.
+*****************************************************/
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <vector>
+#include <stddef.h>
+#include "Triangle.h"
+#include "Material.h"
+#include "TriangleBlock.h"
+
+#ifndef __TRIANGLESOUP_H__
+#define __TRIANGLESOUP_H__
+
+struct TriangleSoup {
+    // hot: packed for the ray-triangle test, in the order of the soup BVH's indices
+    TriangleBlockArray blocks;
+    // cold: three entries per triangle, in soup order
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    // cold: one entry per triangle
+    std::vector<MaterialId> materials;
+
+    size_t size(void) const { return materials.size(); }
+    bool empty(void) const { return materials.empty(); }
+    void clear(void){
+        positions.clear();
+        normals.clear();
+        materials.clear();
+    }
+    void resize(size_t n){
+        positions.resize(3 * n);
+        normals.resize(3 * n);
+        materials.resize(n);
+    }
+    void set(size_t i, const Triangle &t){
+        for (int j = 0; j < 3; j++) {
+            positions[3*i + j] = t.P[j];
+            normals[3*i + j] = t.N[j];
+        }
+        materials[i] = t.material;
+    }
+    // copy of triangle i, e.g. to interpolate a hit on it
+    Triangle triangle(size_t i) const {
+        Triangle t;
+        for (int j = 0; j < 3; j++) {
+            t.P[j] = positions[3*i + j];
+            t.N[j] = normals[3*i + j];
+        }
+        t.material = materials[i];
+        return t;
+    }
+    TriangleEdges edges(size_t i) const {
+        return TriangleEdges(positions[3*i], positions[3*i + 1], positions[3*i + 2]);
+    }
+
+    // memory of each stream
+    size_t blockBytes(void) const { return blocks.size() * sizeof(TriangleBlockArray::value_type); }
+    size_t positionBytes(void) const { return positions.size() * sizeof(glm::vec3); }
+    size_t normalBytes(void) const { return normals.size() * sizeof(glm::vec3); }
+    size_t materialBytes(void) const { return materials.size() * sizeof(MaterialId); }
+};
+
+#endif
@@ -24,13 +24,14 @@ static int width = 200;
 static int height = 150;
 static const char* title = "Scene viewer";
 static const glm::vec4 background(0.1f, 0.2f, 0.3f, 1.0f);
-static Scene scene;
+static Scene scene;    //OpenGL view of RTscene
 
 //added variables
 static Image image(width,height);
 static RTScene RTscene;
 
 static bool RT_mode = false;     //ray tracing mode vs hw3 view mode
+static const char* scene_file = NULL; //.glb scene given on the command line, if any
 
 #include "hw3AutoScreenshots.h"
 
@@ -46,6 +47,12 @@ void printHelp(){
       press 'L' to turn on/off the lighting.
 
       press 'I' to toggle ray tracing/show image.
+      press 'B' to toggle the BVH builder (binned SAH/LBVH).
+      press 'Q' to toggle quantized BVH nodes.
+      press 'P' to toggle tracing primary rays in 8x8 packets.
+      press 'W' to toggle the wavefront renderer (one sorted pass per bounce).
+      press 'C' to toggle out-of-core geometry (clusters paged in from a file).
+      press 'D' to toggle coarser levels of detail for shadow and reflection rays.
     
       press Spacebar to generate images for hw3 submission.
     
@@ -69,11 +76,12 @@ void initialize(void){
     glClearColor(background[0], background[1], background[2], background[3]); // background color
     glViewport(0,0,width,height);
     
-    // Initialize scene
-    scene.init();
+    //initialize RTscene, the one description of the scene
+    if (scene_file) RTscene.init(scene_file);
+    else RTscene.init();
     
-    //initialize RTscene
-    RTscene.init();
+    // Initialize the OpenGL view of it
+    scene.init(&RTscene);
         
     //initialize image
     image.init();
@@ -89,8 +97,8 @@ void display(void){
     
     //check if on ray tracing mode
     if (RT_mode) {
-        //build the scene full of triangles
-        RTscene.buildTriangleSoup();
+        //build the instances (or the scene full of triangles)
+        RTscene.build();
 
         //ray tracing algorithm
         RayTracer::Raytrace(RTscene.camera, RTscene, image);
@@ -123,19 +131,15 @@ void keyboard(unsigned char key, int x, int y){
             saveScreenShot();
             break;
         case 'r':
-            scene.camera -> aspect_default = float(glutGet(GLUT_WINDOW_WIDTH))/float(glutGet(GLUT_WINDOW_HEIGHT));
-            scene.camera -> reset();
             RTscene.camera -> aspect_default = float(glutGet(GLUT_WINDOW_WIDTH))/float(glutGet(GLUT_WINDOW_HEIGHT));
             RTscene.camera -> reset();
             glutPostRedisplay();
             break;
         case 'a':
-            scene.camera -> zoom(0.9f);
             RTscene.camera -> zoom(0.9f);
             glutPostRedisplay();
             break;
         case 'z':
-            scene.camera -> zoom(1.1f);
             RTscene.camera -> zoom(1.1f);
             glutPostRedisplay();
             break;
@@ -147,6 +151,36 @@ void keyboard(unsigned char key, int x, int y){
             hw3AutoScreenshots();
             glutPostRedisplay();
             break;
+        case 'b':
+            //toggle the BVH builder; the next ray traced frame rebuilds every BVH
+            RTscene.bvh_mode = (RTscene.bvh_mode == BVH_LBVH) ? BVH_BINNED_SAH : BVH_LBVH;
+            glutPostRedisplay();
+            break;
+        case 'q':
+            //toggle compressed BVH nodes
+            RTscene.bvh_quantized = !RTscene.bvh_quantized;
+            glutPostRedisplay();
+            break;
+        case 'p':
+            //toggle packets of primary rays
+            RTscene.packet_size = (RTscene.packet_size > 1) ? 1 : 8;
+            glutPostRedisplay();
+            break;
+        case 'w':
+            //toggle the wavefront renderer
+            RTscene.wavefront = !RTscene.wavefront;
+            glutPostRedisplay();
+            break;
+        case 'c':
+            //toggle paging the geometry in clusters from a file; the next ray traced frame rebuilds it
+            RTscene.out_of_core = !RTscene.out_of_core;
+            glutPostRedisplay();
+            break;
+        case 'd':
+            //toggle tracing the secondary rays against the second level of detail of every mesh
+            RTscene.secondary_lod = (RTscene.secondary_lod > 0) ? 0 : 2;
+            glutPostRedisplay();
+            break;
         case 'i':
             //toggle ray tracing mode
             RT_mode = !RT_mode;
@@ -160,22 +194,18 @@ void keyboard(unsigned char key, int x, int y){
 void specialKey(int key, int x, int y){
     switch (key) {
         case GLUT_KEY_UP: // up
-            scene.camera -> rotateUp(-10.0f);
             RTscene.camera -> rotateUp(-10.0f);
             glutPostRedisplay();
             break;
         case GLUT_KEY_DOWN: // down
-            scene.camera -> rotateUp(10.0f);
             RTscene.camera -> rotateUp(10.0f);
             glutPostRedisplay();
             break;
         case GLUT_KEY_RIGHT: // right
-            scene.camera -> rotateRight(-10.0f);
             RTscene.camera -> rotateRight(-10.0f);
             glutPostRedisplay();
             break;
         case GLUT_KEY_LEFT: // left
-            scene.camera -> rotateRight(10.0f);
             RTscene.camera -> rotateRight(10.0f);
             glutPostRedisplay();
             break;
@@ -205,6 +235,9 @@ int main(int argc, char** argv)
     std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
     // END CREATE WINDOW
     
+    // SceneViewer [scene.glb] views the given scene instead of the built-in one
+    if (argc > 1) scene_file = argv[1];
+    
     initialize();
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
@@ -0,0 +1,59 @@
+/**************************************************
+Arena.cpp contains the block management of Arena.
+*****************************************************/
+#include "Arena.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+void* Arena::allocateBlock(size_t bytes, size_t alignment){
+    // a request larger than a block gets a block of its own size
+    size_t size = std::max(block_size, bytes + alignment);
+    Block b;
+    b.data = static_cast<char*>( malloc(size) );
+    if (b.data == NULL) throw std::bad_alloc();
+    b.size = size;
+    b.used = alignmentPadding(b.data, alignment) + bytes;
+    blocks.push_back(b);
+    return b.data + (b.used - bytes);
+}
+
+void Arena::destroyObjects(void){
+    for (size_t i = destructors.size(); i > 0; i--) {
+        destructors[i-1].destroy( destructors[i-1].object );
+    }
+    destructors.clear();
+}
+
+void Arena::reset(void){
+    destroyObjects();
+    // after a frame that needed several blocks, the next one gets them as one
+    if (blocks.size() > 1) {
+        size_t total = bytesReserved();
+        release();
+        Block b;
+        b.data = static_cast<char*>( malloc(total) );
+        if (b.data == NULL) throw std::bad_alloc();
+        b.size = total;
+        blocks.push_back(b);
+    }
+    for (Block &b : blocks) b.used = 0;
+}
+
+void Arena::release(void){
+    destroyObjects();
+    for (Block &b : blocks) free(b.data);
+    blocks.clear();
+}
+
+size_t Arena::bytesUsed(void) const {
+    size_t used = 0;
+    for (const Block &b : blocks) used += b.used;
+    return used;
+}
+
+size_t Arena::bytesReserved(void) const {
+    size_t reserved = 0;
+    for (const Block &b : blocks) reserved += b.size;
+    return reserved;
+}
@@ -0,0 +1,681 @@
+/**************************************************
+BVH.cpp contains the parallel builds of the bounding
+volume hierarchy (binned SAH and LBVH), its refit,
+its collapse into (optionally quantized) wide
+nodes, and the check of a tree read from a file.
+*****************************************************/
+#include "BVH.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+using namespace glm;
+
+// points view at own if it viewed source, the vector own was copied from
+template <typename T, typename Vector>
+static void rebindView(ArrayView<T> &view, const Vector &own, const Vector &source){
+    if (!source.empty() && view.data == &source[0]) view = own;
+}
+
+BVH& BVH::operator=(const BVH &other){
+    if (this == &other) return *this;
+    nodes = other.nodes;
+    indices = other.indices;
+    width = other.width;
+    quantized = other.quantized;
+    nodes4 = other.nodes4;
+    nodes8 = other.nodes8;
+    qnodes4 = other.qnodes4;
+    qnodes8 = other.qnodes8;
+    mode = other.mode;
+    leaf_alignment = other.leaf_alignment;
+    primitive_count = other.primitive_count;
+    build_cost = other.build_cost;
+    build_time = other.build_time;
+    spawn_depth = other.spawn_depth;
+    view = other.view;
+    rebindView(view.nodes, nodes, other.nodes);
+    rebindView(view.indices, indices, other.indices);
+    rebindView(view.nodes4, nodes4, other.nodes4);
+    rebindView(view.nodes8, nodes8, other.nodes8);
+    rebindView(view.qnodes4, qnodes4, other.qnodes4);
+    rebindView(view.qnodes8, qnodes8, other.qnodes8);
+    return *this;
+}
+
+void BVH::build(const std::vector<AABB> &bounds){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const int n = int(bounds.size());
+    view = View();
+    nodes.clear();
+    nodes4.clear();
+    nodes8.clear();
+    qnodes4.clear();
+    qnodes8.clear();
+    indices.resize(n);
+    for (int i = 0; i < n; i++) indices[i] = i;
+    primitive_count = n;
+    build_cost = 0.0f;
+    build_time = 0.0f;
+    if (n == 0) return;
+
+    // centroids are what the primitives get binned (or Morton-coded) by
+    std::vector<vec3> centroids(n);
+    parallelChunks(n, chunkCount(n, chunk_min_size), [&](int c, int begin, int end){
+        for (int i = begin; i < end; i++) centroids[i] = bounds[i].centroid();
+    });
+
+    // A binary tree over n leaves has at most 2n-1 nodes.  Nodes are claimed
+    // from node_count, so parallel tasks never resize the array, and children
+    // always get larger indices than their parent.
+    nodes.resize(2*n - 1);
+    std::atomic<int> node_count(1);
+    nodes[0].left_first = 0;
+    nodes[0].count = n;
+
+    // enough tasks to keep every thread busy
+    spawn_depth = 1;
+    if (threadCount() > 1) {
+        spawn_depth = 2;
+        while ( (1 << (spawn_depth - 2)) < threadCount() ) spawn_depth++;
+    }
+
+    if (mode == BVH_LBVH) {
+        buildLBVH(bounds, centroids, node_count);
+    }
+    else {
+        updateBounds(0, bounds);
+        subdivide(0, bounds, centroids, 1, node_count);
+    }
+    nodes.resize( node_count.load() );
+    if (leaf_alignment > 1) alignLeaves();
+    view.nodes = nodes;
+    view.indices = indices;
+
+    build_cost = cost();
+    collapse(width);
+
+    build_time = std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void BVH::refit(const std::vector<AABB> &bounds){
+    // a tree viewing a cache file is copied before it is changed
+    if (nodes.empty() && !view.nodes.empty()) {
+        nodes.assign(view.nodes.data, view.nodes.data + view.nodes.size());
+        indices.assign(view.indices.data, view.indices.data + view.indices.size());
+        view.nodes = nodes;
+        view.indices = indices;
+    }
+    updateAllBounds(bounds);
+    collapse(width);
+}
+
+void BVH::updateAllBounds(const std::vector<AABB> &bounds){
+    // leaves are independent of each other
+    const int n = int(nodes.size());
+    parallelChunks(n, chunkCount(n, chunk_min_size), [&](int c, int begin, int end){
+        for (int i = begin; i < end; i++) {
+            if (nodes[i].isLeaf()) updateBounds(i, bounds);
+        }
+    });
+    // Children are always stored after their parent, so a reverse sweep
+    // visits every node after both of its children.
+    for (int i = n - 1; i >= 0; i--) {
+        BVHNode &node = nodes[i];
+        if (!node.isLeaf()) {
+            node.box = nodes[node.left_first].box;
+            node.box.grow( nodes[node.left_first + 1].box );
+        }
+    }
+}
+
+void BVH::updateBounds(int node_idx, const std::vector<AABB> &bounds){
+    BVHNode &node = nodes[node_idx];
+    node.box = AABB();
+    for (int i = 0; i < node.count; i++) {
+        node.box.grow( bounds[ indices[node.left_first + i] ] );
+    }
+}
+
+void BVH::alignLeaves(void){
+    // the leaves partition indices; move their ranges, in order, to aligned starts
+    std::vector<int> leaves;
+    for (int i = 0; i < int(nodes.size()); i++) {
+        if (nodes[i].isLeaf()) leaves.push_back(i);
+    }
+    std::sort(leaves.begin(), leaves.end(), [&](int a, int b){ return nodes[a].left_first < nodes[b].left_first; });
+
+    std::vector<int> aligned;
+    aligned.reserve( indices.size() + leaves.size() * (leaf_alignment - 1) );
+    for (int leaf_idx : leaves) {
+        BVHNode &leaf = nodes[leaf_idx];
+        int first = int(aligned.size());
+        aligned.insert(aligned.end(), indices.begin() + leaf.left_first, indices.begin() + leaf.left_first + leaf.count);
+        aligned.resize( (aligned.size() + leaf_alignment - 1) / leaf_alignment * leaf_alignment, -1 );
+        leaf.left_first = first;
+    }
+    indices.swap(aligned);
+}
+
+const char* BVH::modeName(void) const {
+    return mode == BVH_LBVH ? "LBVH" : "binned SAH";
+}
+
+// bins of one chunk of primitives, along all three axes
+struct BVHBins {
+    AABB centroid_box; // only used in the first pass
+    AABB box[3][BVH::bin_count];
+    int num[3][BVH::bin_count];
+};
+
+void BVH::subdivide(int node_idx, const std::vector<AABB> &bounds, const std::vector<vec3> &centroids,
+                    int depth, std::atomic<int> &node_count){
+    const int first = nodes[node_idx].left_first;
+    const int count = nodes[node_idx].count;
+    if (count <= 1 || depth >= max_depth) return;
+
+    // large nodes are binned in parallel chunks that are merged afterwards
+    const int chunks = chunkCount(count, chunk_min_size);
+    BVHBins single_bins;
+    std::vector<BVHBins> many_bins;
+    BVHBins *chunk_bins = &single_bins;
+    if (chunks > 1) {
+        many_bins.resize(chunks);
+        chunk_bins = &many_bins[0];
+    }
+
+    // bounding box of the centroids
+    parallelChunks(count, chunks, [&](int c, int begin, int end){
+        for (int i = begin; i < end; i++) chunk_bins[c].centroid_box.grow( centroids[ indices[first + i] ] );
+    });
+    AABB centroid_box;
+    for (int c = 0; c < chunks; c++) centroid_box.grow( chunk_bins[c].centroid_box );
+    vec3 extent = centroid_box.max - centroid_box.min;
+    vec3 scale;
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] > 0.0f ? bin_count / extent[axis] : 0.0f;
+    }
+
+    // bin the primitives by centroid
+    parallelChunks(count, chunks, [&](int c, int begin, int end){
+        BVHBins &bins = chunk_bins[c];
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < bin_count; b++) bins.num[axis][b] = 0;
+        }
+        for (int i = begin; i < end; i++) {
+            int prim = indices[first + i];
+            for (int axis = 0; axis < 3; axis++) {
+                int b = std::min(bin_count - 1, int( (centroids[prim][axis] - centroid_box.min[axis]) * scale[axis] ));
+                bins.num[axis][b]++;
+                bins.box[axis][b].grow( bounds[prim] );
+            }
+        }
+    });
+    BVHBins &bins = chunk_bins[0];
+    for (int c = 1; c < chunks; c++) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < bin_count; b++) {
+                bins.num[axis][b] += chunk_bins[c].num[axis][b];
+                bins.box[axis][b].grow( chunk_bins[c].box[axis][b] );
+            }
+        }
+    }
+
+    int best_axis = -1;
+    int best_split = 0;
+    float best_cost = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.0f) continue;
+
+        // sweep from both sides to get the area and count of every split plane
+        float left_area[bin_count - 1], right_area[bin_count - 1];
+        int left_num[bin_count - 1], right_num[bin_count - 1];
+        AABB left_box, right_box;
+        int left_sum = 0, right_sum = 0;
+        for (int i = 0; i < bin_count - 1; i++) {
+            left_sum += bins.num[axis][i];
+            left_box.grow( bins.box[axis][i] );
+            left_num[i] = left_sum;
+            left_area[i] = left_box.area();
+
+            right_sum += bins.num[axis][bin_count - 1 - i];
+            right_box.grow( bins.box[axis][bin_count - 1 - i] );
+            right_num[bin_count - 2 - i] = right_sum;
+            right_area[bin_count - 2 - i] = right_box.area();
+        }
+        for (int i = 0; i < bin_count - 1; i++) {
+            if (left_num[i] == 0 || right_num[i] == 0) continue;
+            float c = leafCost(left_num[i])*left_area[i] + leafCost(right_num[i])*right_area[i];
+            if (c < best_cost) {
+                best_cost = c;
+                best_axis = axis;
+                best_split = i + 1; // bins [0, best_split) go to the left
+            }
+        }
+    }
+
+    // all centroids coincide: nothing to split
+    if (best_axis < 0) return;
+
+    float leaf_cost = intersect_cost * leafCost(count);
+    float split_cost = traversal_cost + intersect_cost * best_cost / nodes[node_idx].box.area();
+    if (split_cost >= leaf_cost && count <= leafSize(max_leaf_size)) return;
+
+    // partition the primitive indices in place
+    int i = first;
+    int j = first + count - 1;
+    while (i <= j) {
+        int b = std::min(bin_count - 1, int( (centroids[ indices[i] ][best_axis] - centroid_box.min[best_axis]) * scale[best_axis] ));
+        if (b < best_split) i++;
+        else std::swap( indices[i], indices[j--] );
+    }
+    int left_count = i - first;
+    if (left_count == 0 || left_count == count) return;
+
+    // create the two children; their boxes are the merged bins on either side of the split
+    int left_idx = node_count.fetch_add(2);
+    nodes[left_idx].left_first = first;
+    nodes[left_idx].count = left_count;
+    nodes[left_idx].box = AABB();
+    nodes[left_idx + 1].left_first = i;
+    nodes[left_idx + 1].count = count - left_count;
+    nodes[left_idx + 1].box = AABB();
+    for (int b = 0; b < bin_count; b++) {
+        nodes[left_idx + (b < best_split ? 0 : 1)].box.grow( bins.box[best_axis][b] );
+    }
+    nodes[node_idx].left_first = left_idx;
+    nodes[node_idx].count = 0;
+
+    // near the root, the left subtree is built as a separate task
+    if (depth < spawn_depth && count >= task_min_size) {
+        std::future<void> left_task = std::async(std::launch::async, [&](){
+            subdivide(left_idx, bounds, centroids, depth + 1, node_count);
+        });
+        subdivide(left_idx + 1, bounds, centroids, depth + 1, node_count);
+        left_task.get();
+    }
+    else {
+        subdivide(left_idx, bounds, centroids, depth + 1, node_count);
+        subdivide(left_idx + 1, bounds, centroids, depth + 1, node_count);
+    }
+}
+
+// spreads the lower 10 bits of v so that there are two zero bits between each
+static uint32_t expandBits(uint32_t v){
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point in the unit cube
+static uint32_t morton3D(vec3 p){
+    p = clamp(p * 1024.0f, vec3(0.0f), vec3(1023.0f));
+    return (expandBits(uint32_t(p.x)) << 2) | (expandBits(uint32_t(p.y)) << 1) | expandBits(uint32_t(p.z));
+}
+
+void BVH::buildLBVH(const std::vector<AABB> &bounds, const std::vector<vec3> &centroids, std::atomic<int> &node_count){
+    const int n = int(indices.size());
+    const int chunks = chunkCount(n, chunk_min_size);
+
+    // Morton codes of the centroids, relative to their bounding box
+    std::vector<AABB> chunk_box(chunks);
+    parallelChunks(n, chunks, [&](int c, int begin, int end){
+        for (int i = begin; i < end; i++) chunk_box[c].grow( centroids[i] );
+    });
+    AABB centroid_box;
+    for (int c = 0; c < chunks; c++) centroid_box.grow( chunk_box[c] );
+    vec3 extent = centroid_box.max - centroid_box.min;
+    vec3 scale;
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+    }
+    std::vector<uint32_t> codes(n), codes_tmp(n);
+    std::vector<int> indices_tmp(n);
+    parallelChunks(n, chunks, [&](int c, int begin, int end){
+        for (int i = begin; i < end; i++) codes[i] = morton3D( (centroids[i] - centroid_box.min) * scale );
+    });
+
+    // LSD radix sort of (code, index) pairs, 8 bits per pass.  Each chunk
+    // counts its digits, and scatters from its own offsets, so the sort is stable.
+    std::vector<int> histogram(chunks * 256);
+    for (int shift = 0; shift < 32; shift += 8) {
+        parallelChunks(n, chunks, [&](int c, int begin, int end){
+            int *h = &histogram[c * 256];
+            for (int d = 0; d < 256; d++) h[d] = 0;
+            for (int i = begin; i < end; i++) h[ (codes[i] >> shift) & 0xFF ]++;
+        });
+        int offset = 0;
+        for (int d = 0; d < 256; d++) {
+            for (int c = 0; c < chunks; c++) {
+                int num = histogram[c * 256 + d];
+                histogram[c * 256 + d] = offset;
+                offset += num;
+            }
+        }
+        parallelChunks(n, chunks, [&](int c, int begin, int end){
+            int *h = &histogram[c * 256];
+            for (int i = begin; i < end; i++) {
+                int dst = h[ (codes[i] >> shift) & 0xFF ]++;
+                codes_tmp[dst] = codes[i];
+                indices_tmp[dst] = indices[i];
+            }
+        });
+        codes.swap(codes_tmp);
+        indices.swap(indices_tmp);
+    }
+
+    // split the sorted range top-down, then fit the boxes bottom-up
+    splitLBVH(0, codes, 1, node_count);
+    nodes.resize( node_count.load() );
+    updateAllBounds(bounds);
+}
+
+void BVH::splitLBVH(int node_idx, const std::vector<uint32_t> &codes, int depth, std::atomic<int> &node_count){
+    const int first = nodes[node_idx].left_first;
+    const int count = nodes[node_idx].count;
+    if (count <= leafSize(lbvh_leaf_size) || depth >= max_depth) return;
+
+    // split where the highest bit that differs within the range flips
+    const int last = first + count - 1;
+    int split; // last index of the left child
+    if (codes[first] == codes[last]) {
+        split = first + count/2 - 1;
+    }
+    else {
+        int common_prefix = __builtin_clz( codes[first] ^ codes[last] );
+        split = first;
+        int step = last - first;
+        do {
+            step = (step + 1) >> 1;
+            int new_split = split + step;
+            if (new_split < last && __builtin_clz( codes[first] ^ codes[new_split] ) > common_prefix) {
+                split = new_split;
+            }
+        } while (step > 1);
+    }
+
+    int left_idx = node_count.fetch_add(2);
+    nodes[left_idx].left_first = first;
+    nodes[left_idx].count = split - first + 1;
+    nodes[left_idx + 1].left_first = split + 1;
+    nodes[left_idx + 1].count = last - split;
+    nodes[node_idx].left_first = left_idx;
+    nodes[node_idx].count = 0;
+
+    if (depth < spawn_depth && count >= task_min_size) {
+        std::future<void> left_task = std::async(std::launch::async, [&](){
+            splitLBVH(left_idx, codes, depth + 1, node_count);
+        });
+        splitLBVH(left_idx + 1, codes, depth + 1, node_count);
+        left_task.get();
+    }
+    else {
+        splitLBVH(left_idx, codes, depth + 1, node_count);
+        splitLBVH(left_idx + 1, codes, depth + 1, node_count);
+    }
+}
+
+float BVH::cost(void) const {
+    if (view.nodes.empty()) return 0.0f;
+    float root_area = view.nodes[0].box.area();
+    if (root_area <= 0.0f) return 0.0f;
+
+    float sum = 0.0f;
+    for (size_t i = 0; i < view.nodes.size(); i++) {
+        const BVHNode &node = view.nodes[i];
+        if (node.isLeaf()) sum += intersect_cost * node.count * node.box.area();
+        else sum += traversal_cost * node.box.area();
+    }
+    return sum / root_area;
+}
+
+// Leaf ranges stay inside the indices, and interior children come after their
+// parent (as every builder lays them out) and inside nodes, no deeper than the
+// traversal stack allows.
+template <typename WideNode>
+static bool validWide(const ArrayView<WideNode> &nodes, size_t index_count, int max_depth){
+    const int W = WideNode::width;
+    std::vector<int> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (int k = 0; k < W; k++) {
+            int child = nodes[i].child[k];
+            int count = nodes[i].childCount(k);
+            if (count < 0) continue;
+            if (count > 0) {
+                if (child < 0 || size_t(child) + size_t(count) > index_count) return false;
+                continue;
+            }
+            if (child <= int(i) || size_t(child) >= nodes.size()) return false;
+            depth[child] = std::max(depth[child], depth[i] + 1);
+            if (depth[child] >= max_depth) return false;
+        }
+    }
+    return true;
+}
+
+bool BVH::valid(void) const {
+    if (view.nodes.empty()) return false;
+    for (size_t i = 0; i < view.indices.size(); i++) {
+        if (view.indices[i] < -1 || view.indices[i] >= primitive_count) return false;
+    }
+    std::vector<int> depth(view.nodes.size(), 0);
+    for (size_t i = 0; i < view.nodes.size(); i++) {
+        const BVHNode &node = view.nodes[i];
+        if (node.isLeaf()) {
+            if (node.left_first < 0 || size_t(node.left_first) + size_t(node.count) > view.indices.size()) return false;
+            continue;
+        }
+        if (node.left_first <= int(i) || size_t(node.left_first) + 1 >= view.nodes.size()) return false;
+        for (int c = node.left_first; c <= node.left_first + 1; c++) {
+            depth[c] = std::max(depth[c], depth[i] + 1);
+            if (depth[c] >= max_depth) return false;
+        }
+    }
+
+    // the wide nodes traversed at this width have to be there
+    if (width == 4 && (quantized ? view.qnodes4.empty() : view.nodes4.empty())) return false;
+    if (width == 8 && (quantized ? view.qnodes8.empty() : view.nodes8.empty())) return false;
+    if (width != 2 && width != 4 && width != 8) return false;
+    return validWide(view.nodes4, view.indices.size(), max_stack_depth) && validWide(view.nodes8, view.indices.size(), max_stack_depth)
+        && validWide(view.qnodes4, view.indices.size(), max_stack_depth) && validWide(view.qnodes8, view.indices.size(), max_stack_depth);
+}
+
+size_t BVH::bytes(void) const {
+    size_t node_bytes = view.nodes.size() * sizeof(BVHNode);
+    if (width == 4) node_bytes = quantized ? view.qnodes4.size() * sizeof(view.qnodes4[0]) : view.nodes4.size() * sizeof(view.nodes4[0]);
+    else if (width == 8) node_bytes = quantized ? view.qnodes8.size() * sizeof(view.qnodes8[0]) : view.nodes8.size() * sizeof(view.nodes8[0]);
+    return node_bytes + view.indices.size() * sizeof(int);
+}
+
+void BVH::collapse(int new_width){
+    collapse(new_width, quantized);
+}
+
+void BVH::collapse(int new_width, bool new_quantized){
+    width = new_width;
+    quantized = new_quantized;
+    nodes4.clear();
+    nodes8.clear();
+    qnodes4.clear();
+    qnodes8.clear();
+
+    if (!view.nodes.empty()) {
+        if (width == 4) collapseNode(nodes4, 0);
+        else if (width == 8) collapseNode(nodes8, 0);
+
+        // the compressed nodes are derived from the full-precision ones, in the same order
+        if (quantized && width == 4) {
+            quantize<4>(nodes4, qnodes4);
+            nodes4.clear();
+        }
+        else if (quantized && width == 8) {
+            quantize<8>(nodes8, qnodes8);
+            nodes8.clear();
+        }
+    }
+
+    view.nodes4 = nodes4;
+    view.nodes8 = nodes8;
+    view.qnodes4 = qnodes4;
+    view.qnodes8 = qnodes8;
+}
+
+template <typename WideVector>
+int BVH::collapseNode(WideVector &wide, int node_idx) const {
+    typedef typename WideVector::value_type WideNode;
+    const int W = WideNode::width;
+
+    // Gather up to W descendants of the binary node by repeatedly opening
+    // the interior child with the largest surface area.
+    int children[W];
+    int n = 0;
+    if (view.nodes[node_idx].isLeaf()) {
+        children[n++] = node_idx; // only happens at the root of a tiny tree
+    }
+    else {
+        children[n++] = view.nodes[node_idx].left_first;
+        children[n++] = view.nodes[node_idx].left_first + 1;
+    }
+    while (n < W) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int k = 0; k < n; k++) {
+            const BVHNode &c = view.nodes[ children[k] ];
+            if (!c.isLeaf() && c.box.area() > best_area) {
+                best = k;
+                best_area = c.box.area();
+            }
+        }
+        if (best < 0) break;
+        int opened = children[best];
+        children[best] = view.nodes[opened].left_first;
+        children[n++] = view.nodes[opened].left_first + 1;
+    }
+
+    // wide may reallocate while the children are collapsed, so index it by position
+    int wide_idx = int(wide.size());
+    wide.push_back( WideNode() );
+    for (int k = 0; k < n; k++) {
+        const BVHNode &c = view.nodes[ children[k] ];
+        if (c.isLeaf()) {
+            wide[wide_idx].setChild(k, c.box, c.left_first, c.count);
+        }
+        else {
+            int child_idx = collapseNode(wide, children[k]);
+            wide[wide_idx].setChild(k, c.box, child_idx, 0);
+        }
+    }
+    return wide_idx;
+}
+
+// quantizes the planes [lo, hi] of one axis of a child box to 8-bit offsets from origin
+static void quantizePlanes(float lo, float hi, float origin, float scale, uint8_t &qlo, uint8_t &qhi){
+    float flo = floorf( (lo - origin) / scale );
+    float fhi = ceilf( (hi - origin) / scale );
+    int ilo = int( glm::clamp(flo, 0.0f, 255.0f) );
+    int ihi = int( glm::clamp(fhi, 0.0f, 255.0f) );
+    // make sure the rounding went outwards
+    while (ilo > 0 && origin + ilo * scale > lo) ilo--;
+    while (ihi < 255 && origin + ihi * scale < hi) ihi++;
+    qlo = uint8_t(ilo);
+    qhi = uint8_t(ihi);
+}
+
+template <int W, typename WideVector, typename QuantizedVector>
+void BVH::quantize(const WideVector &wide, QuantizedVector &out) const {
+    typedef QuantizedBVHNode<W> QNode;
+    out.resize( wide.size() );
+
+    // A leaf with more primitives than a compressed node can count is split
+    // over extra nodes appended after the depth-first part; they reuse the
+    // leaf box for all of their slots.
+    struct LeafSplit {
+        int node;
+        int slot;
+        int first;
+        int count;
+    };
+    std::vector<LeafSplit> large_leaves;
+
+    for (size_t i = 0; i < wide.size(); i++) {
+        const WideBVHNode<W> &w = wide[i];
+        QNode &q = out[i];
+        q = QNode();
+
+        // the node box is the union of its children
+        AABB node_box;
+        for (int k = 0; k < W; k++) {
+            if (w.count[k] >= 0) node_box.grow( w.childBox(k) );
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            float origin = node_box.min[axis];
+            float extent = node_box.max[axis] - origin;
+            // smallest power of two step with which 255 steps cover the extent
+            int e = -126;
+            if (extent > 0.0f) {
+                frexpf(extent / 255.0f, &e);
+                e = std::max(e, -126);
+                while (origin + 255.0f * ldexpf(1.0f, e) < node_box.max[axis]) e++;
+            }
+            q.origin[axis] = origin;
+            q.exponent[axis] = int8_t( std::min(e, 127) );
+        }
+
+        uint8_t *qmin[3] = {q.qmin_x, q.qmin_y, q.qmin_z};
+        uint8_t *qmax[3] = {q.qmax_x, q.qmax_y, q.qmax_z};
+        for (int k = 0; k < W; k++) {
+            if (w.count[k] < 0) continue;
+            AABB box = w.childBox(k);
+            for (int axis = 0; axis < 3; axis++) {
+                quantizePlanes(box.min[axis], box.max[axis], q.origin[axis], q.scale(axis), qmin[axis][k], qmax[axis][k]);
+            }
+            q.child[k] = w.child[k];
+            if (w.count[k] <= QNode::max_leaf_size) {
+                q.count[k] = uint8_t(w.count[k]);
+            }
+            else {
+                LeafSplit split = {int(i), k, w.child[k], w.count[k]};
+                large_leaves.push_back(split);
+            }
+        }
+    }
+
+    // Each large leaf becomes an interior child whose node holds W slots of the
+    // same box; a slot that still has too many primitives is split again.
+    for (size_t j = 0; j < large_leaves.size(); j++) {
+        LeafSplit split = large_leaves[j];
+        int node_idx = int(out.size());
+        QNode copy = out[split.node]; // same origin and exponents, so the slot boxes can be copied
+        out.push_back(copy);
+        out[split.node].child[split.slot] = node_idx;
+        out[split.node].count[split.slot] = 0;
+
+        QNode &q = out[node_idx];
+        const QNode &parent = out[split.node];
+        int per_slot = (split.count + W - 1) / W;
+        for (int k = 0; k < W; k++) {
+            int first = split.first + k * per_slot;
+            int count = std::min(per_slot, split.first + split.count - first);
+            q.qmin_x[k] = parent.qmin_x[split.slot]; q.qmax_x[k] = parent.qmax_x[split.slot];
+            q.qmin_y[k] = parent.qmin_y[split.slot]; q.qmax_y[k] = parent.qmax_y[split.slot];
+            q.qmin_z[k] = parent.qmin_z[split.slot]; q.qmax_z[k] = parent.qmax_z[split.slot];
+            if (count <= 0) {
+                q.count[k] = 255;
+                q.child[k] = -1;
+            }
+            else if (count <= QNode::max_leaf_size) {
+                q.count[k] = uint8_t(count);
+                q.child[k] = first;
+            }
+            else {
+                LeafSplit again = {node_idx, k, first, count};
+                large_leaves.push_back(again);
+            }
+        }
+    }
+}
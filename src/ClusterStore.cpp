@@ -0,0 +1,339 @@
+/**************************************************
+ClusterStore.cpp contains the writing of the cluster
+file (grid counts, cluster layout, placement of the
+triangles and the BVH of every cluster) and the
+paging of the clusters with LRU eviction.
+*****************************************************/
+#include "ClusterStore.h"
+
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace glm;
+
+static const uint64_t cluster_alignment = 64;
+
+static uint64_t alignUp(uint64_t bytes){
+    return (bytes + cluster_alignment - 1) / cluster_alignment * cluster_alignment;
+}
+
+// bytes of the triangle streams of n triangles
+static uint64_t streamBytes(uint64_t n){
+    return n * (6 * sizeof(vec3) + sizeof(MaterialId));
+}
+
+static bool writeAll(int fd, const void* data, size_t bytes, uint64_t offset){
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, p, bytes, off_t(offset));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        bytes -= size_t(written);
+        offset += uint64_t(written);
+    }
+    return true;
+}
+
+void ClusterStore::begin(const std::string &file_path, const AABB &bounds){
+    close();
+    path = file_path;
+    grid_box = bounds;
+    cell_count.assign(size_t(1) << (3 * grid_bits), 0);
+}
+
+uint32_t ClusterStore::cellOf(const vec3 *P) const {
+    // Morton code of the grid cell of the centroid, so that consecutive cells are close
+    const int cells = 1 << grid_bits;
+    vec3 centroid = (P[0] + P[1] + P[2]) / 3.0f;
+    vec3 extent = grid_box.max - grid_box.min;
+    uint32_t q[3];
+    for (int a = 0; a < 3; a++) {
+        float x = extent[a] > 0.0f ? (centroid[a] - grid_box.min[a]) / extent[a] * float(cells) : 0.0f;
+        q[a] = uint32_t( glm::clamp(int(x), 0, cells - 1) );
+    }
+    uint32_t code = 0;
+    for (int b = grid_bits - 1; b >= 0; b--) {
+        for (int a = 0; a < 3; a++) code = (code << 1) | ((q[a] >> b) & 1);
+    }
+    return code;
+}
+
+void ClusterStore::count(const TriangleSoup &batch){
+    for (size_t i = 0; i < batch.size(); i++) {
+        cell_count[ cellOf(&batch.positions[3*i]) ]++;
+    }
+}
+
+bool ClusterStore::layout(void){
+    // Cells are taken in Morton order and gathered into clusters of up to
+    // cluster_size triangles; a cell with more than that is cut into clusters of its own.
+    const size_t cells = cell_count.size();
+    const uint64_t limit = uint64_t(cluster_size);
+    cell_cluster.assign(cells, 0);
+    cell_slot.assign(cells, 0);
+    cell_written.assign(cells, 0);
+    clusters.clear();
+    bool open = false; // whether the last cluster takes more cells
+    for (size_t cell = 0; cell < cells; cell++) {
+        uint64_t n = cell_count[cell];
+        if (n == 0) continue;
+        if (n > limit) {
+            open = false;
+            cell_cluster[cell] = uint32_t(clusters.size());
+            for (uint64_t first = 0; first < n; first += limit) {
+                clusters.push_back( Cluster() );
+                clusters.back().triangle_count = uint32_t( std::min(limit, n - first) );
+            }
+            continue;
+        }
+        if (!open || clusters.back().triangle_count + n > limit) {
+            clusters.push_back( Cluster() );
+            open = true;
+        }
+        cell_cluster[cell] = uint32_t(clusters.size() - 1);
+        cell_slot[cell] = clusters.back().triangle_count;
+        clusters.back().triangle_count += uint32_t(n);
+    }
+
+    uint64_t offset = 0;
+    triangle_count = 0;
+    for (Cluster &c : clusters) {
+        c.offset = offset;
+        offset += alignUp( streamBytes(c.triangle_count) );
+        triangle_count += c.triangle_count;
+    }
+    writable_size = size_t(offset);
+    if (writable_size == 0) return true;
+
+    // a name of its own, so that viewers in the same directory do not write over each other's clusters
+    std::string unique_path = path + ".XXXXXX";
+    fd = mkstemp(&unique_path[0]);
+    if (fd >= 0) path = unique_path;
+    if (fd < 0 || ftruncate(fd, off_t(writable_size)) != 0) {
+        std::cerr << "Cannot write cluster file: " << path << std::endl;
+        close();
+        return false;
+    }
+    void* p = mmap(NULL, writable_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map cluster file: " << path << std::endl;
+        close();
+        return false;
+    }
+    writable = static_cast<char*>(p);
+    return true;
+}
+
+void ClusterStore::write(const TriangleSoup &batch){
+    const uint64_t limit = uint64_t(cluster_size);
+    for (size_t i = 0; i < batch.size(); i++) {
+        uint32_t cell = cellOf(&batch.positions[3*i]);
+        uint64_t j = cell_written[cell]++;
+        int c = int(cell_cluster[cell]);
+        uint64_t slot = cell_slot[cell] + j;
+        if (cell_count[cell] > limit) {
+            c += int(j / limit);
+            slot = j % limit;
+        }
+        Cluster &cl = clusters[c];
+        char* streams = writable + cl.offset;
+        vec3* P = reinterpret_cast<vec3*>(streams);
+        vec3* N = P + 3 * size_t(cl.triangle_count);
+        MaterialId* materials = reinterpret_cast<MaterialId*>(N + 3 * size_t(cl.triangle_count));
+        for (int k = 0; k < 3; k++) {
+            P[3*slot + k] = batch.positions[3*i + k];
+            N[3*slot + k] = batch.normals[3*i + k];
+        }
+        materials[slot] = batch.materials[i];
+    }
+}
+
+bool ClusterStore::finish(int bvh_width, bool bvh_quantized, BVHBuildMode mode){
+    width = bvh_width;
+    quantized = bvh_quantized;
+    std::vector<uint64_t>().swap(cell_count);
+    std::vector<uint32_t>().swap(cell_cluster);
+    std::vector<uint32_t>().swap(cell_slot);
+    std::vector<uint64_t>().swap(cell_written);
+    if (clusters.empty()) return true;
+
+    // the binary BVH of every cluster, appended after the triangle streams;
+    // a page collapses it to the traversal width when it is paged in
+    uint64_t offset = writable_size;
+    std::vector<AABB> bounds;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        Cluster &cl = clusters[c];
+        const vec3* P = positions(int(c));
+        bounds.assign(cl.triangle_count, AABB());
+        for (size_t i = 0; i < bounds.size(); i++) {
+            for (int k = 0; k < 3; k++) bounds[i].grow( P[3*i + k] );
+        }
+        BVH tree;
+        tree.mode = mode;
+        tree.leaf_alignment = triangle_block_width;
+        tree.build(bounds);
+        cl.box = tree.nodes[0].box;
+        cl.bvh_offset = offset;
+        cl.node_count = uint32_t(tree.nodes.size());
+        cl.index_count = uint32_t(tree.indices.size());
+        size_t node_bytes = tree.nodes.size() * sizeof(BVHNode);
+        if (!writeAll(fd, tree.nodes.data(), node_bytes, offset)
+            || !writeAll(fd, tree.indices.data(), tree.indices.size() * sizeof(int), offset + node_bytes)) {
+            std::cerr << "Cannot write cluster file: " << path << std::endl;
+            close();
+            return false;
+        }
+        offset += alignUp( node_bytes + tree.indices.size() * sizeof(int) );
+    }
+    munmap(writable, writable_size);
+    writable = NULL;
+    ::close(fd);
+    fd = -1;
+
+    // Read it back through a read-only mapping.  The file is removed right away:
+    // the mapping keeps its contents until the store is closed.
+    file.reset(new MappedFile());
+    bool mapped = file -> open(path.c_str());
+    unlink(path.c_str());
+    if (!mapped) {
+        std::cerr << "Cannot map cluster file: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    std::vector<AABB> boxes( clusters.size() );
+    for (size_t c = 0; c < clusters.size(); c++) boxes[c] = clusters[c].box;
+    bvh = BVH();
+    bvh.width = width;
+    bvh.mode = mode;
+    bvh.quantized = quantized;
+    bvh.build(boxes);
+    return true;
+}
+
+void ClusterStore::close(void){
+    for (Cluster &c : clusters) c.page.reset();
+    clusters.clear();
+    lru.clear();
+    resident_bytes = 0;
+    resident_count = 0;
+    triangle_count = 0;
+    bvh = BVH();
+    if (writable != NULL) munmap(writable, writable_size);
+    writable = NULL;
+    writable_size = 0;
+    if (fd >= 0) {
+        // a file left half-written
+        ::close(fd);
+        unlink(path.c_str());
+    }
+    fd = -1;
+    file.reset();
+}
+
+const vec3* ClusterStore::positions(int c) const {
+    return reinterpret_cast<const vec3*>(base() + clusters[c].offset);
+}
+
+const vec3* ClusterStore::normals(int c) const {
+    return positions(c) + 3 * size_t(clusters[c].triangle_count);
+}
+
+const MaterialId* ClusterStore::materials(int c) const {
+    return reinterpret_cast<const MaterialId*>( normals(c) + 3 * size_t(clusters[c].triangle_count) );
+}
+
+Triangle ClusterStore::triangle(int c, int i) const {
+    const vec3* P = positions(c);
+    const vec3* N = normals(c);
+    Triangle t;
+    for (int k = 0; k < 3; k++) {
+        t.P[k] = P[3*i + k];
+        t.N[k] = N[3*i + k];
+    }
+    t.material = materials(c)[i];
+    return t;
+}
+
+const ClusterPage& ClusterStore::acquire(int c){
+    Cluster &cl = clusters[c];
+    if (cl.page) {
+        lru.splice(lru.begin(), lru, cl.lru);
+        return *cl.page;
+    }
+
+    // copy the cluster's BVH out of the file, then collapse it and pack its triangles
+    std::unique_ptr<ClusterPage> page(new ClusterPage());
+    const BVHNode* nodes = reinterpret_cast<const BVHNode*>(file -> data + cl.bvh_offset);
+    const int* indices = reinterpret_cast<const int*>(nodes + cl.node_count);
+    BVH &tree = page -> bvh;
+    tree.nodes.assign(nodes, nodes + cl.node_count);
+    tree.indices.assign(indices, indices + cl.index_count);
+    tree.view.nodes = tree.nodes;
+    tree.view.indices = tree.indices;
+    tree.leaf_alignment = triangle_block_width;
+    tree.primitive_count = int(cl.triangle_count);
+    tree.collapse(width, quantized);
+    const vec3* P = positions(c);
+    packTriangleBlocks(tree, [P](int i){ return TriangleEdges(P[3*i], P[3*i + 1], P[3*i + 2]); }, page -> blocks);
+    page -> bytes = tree.bytes() + page -> blocks.size() * sizeof(TriangleBlockArray::value_type);
+    if (width > 2) page -> bytes += tree.nodes.size() * sizeof(BVHNode); // the packet traversal reads the binary nodes
+
+    resident_bytes += page -> bytes;
+    resident_count++;
+    page_ins++;
+    lru.push_front(c);
+    cl.lru = lru.begin();
+    cl.page = std::move(page);
+    fitBudget(c);
+    return *cl.page;
+}
+
+void ClusterStore::evict(int c){
+    Cluster &cl = clusters[c];
+    resident_bytes -= cl.page -> bytes;
+    resident_count--;
+    evictions++;
+    lru.erase(cl.lru);
+    cl.page.reset();
+    adviseDone(c);
+}
+
+void ClusterStore::fitBudget(int keep){
+    // the cluster being traced (keep) stays, even when it alone exceeds the budget
+    while (resident_bytes > budget && !lru.empty() && lru.back() != keep) evict(lru.back());
+}
+
+void ClusterStore::setBudget(size_t bytes){
+    budget = bytes;
+    fitBudget(-1);
+}
+
+void ClusterStore::adviseDone(int c) const {
+    // the mapped pages of an evicted cluster are given back as well; they are
+    // read again from the file (or the page cache) if the cluster is hit later
+    static const uintptr_t page_size = uintptr_t( sysconf(_SC_PAGESIZE) );
+    const Cluster &cl = clusters[c];
+    const uint64_t ranges[2][2] = {
+        { cl.offset, streamBytes(cl.triangle_count) },
+        { cl.bvh_offset, cl.node_count * sizeof(BVHNode) + cl.index_count * sizeof(int) }
+    };
+    for (int r = 0; r < 2; r++) {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(file -> data + ranges[r][0]) / page_size * page_size;
+        uintptr_t end = reinterpret_cast<uintptr_t>(file -> data + ranges[r][0] + ranges[r][1]);
+        if (end > begin) madvise(reinterpret_cast<void*>(begin), size_t(end - begin), MADV_DONTNEED);
+    }
+}
+
+void ClusterStore::printFrameStats(void) const {
+    std::cout << "Out-of-core: " << page_ins << " page-ins, " << evictions << " evictions; "
+              << resident_count << " of " << clusters.size() << " clusters resident ("
+              << resident_bytes / 1024 << " of " << budget / 1024 << " KB)." << std::endl;
+}
@@ -0,0 +1,651 @@
+/**************************************************
+GLBLoader.cpp contains the .glb importer: a small
+JSON parser for the scene description, the accessors
+that view the binary chunk in place, and the mapping
+of glTF meshes, materials and nodes onto the scene.
+*****************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "GLBLoader.h"
+#include "RTCache.h"
+#include "Parallel.h"
+
+using namespace glm;
+
+// A parsed JSON value.  An object keeps its keys and values in two parallel
+// arrays; an array only uses the values.
+struct JsonValue {
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<std::string> keys;
+    std::vector<JsonValue> values;
+
+    // member key of an object, or a null value
+    const JsonValue& member(const char* key) const;
+    // element i of an array, or a null value
+    const JsonValue& at(size_t i) const;
+    size_t size(void) const { return type == ARRAY ? values.size() : 0; }
+    bool isNull(void) const { return type == NUL; }
+    double numberOr(double fallback) const { return type == NUMBER ? number : fallback; }
+};
+
+static const JsonValue json_null = JsonValue();
+
+const JsonValue& JsonValue::member(const char* key) const {
+    if (type != OBJECT) return json_null;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == key) return values[i];
+    }
+    return json_null;
+}
+
+const JsonValue& JsonValue::at(size_t i) const {
+    return (type == ARRAY && i < values.size()) ? values[i] : json_null;
+}
+
+// Recursive descent over the JSON text [p, end); on failure error says where.
+struct JsonParser {
+    const char* begin;
+    const char* p;
+    const char* end;
+    std::string error;
+
+    static const int max_depth = 256;
+
+    JsonParser(const char* text, size_t size) : begin(text), p(text), end(text + size) {}
+
+    bool fail(const char* what){
+        if (error.empty()) error = std::string(what) + " at byte " + std::to_string(p - begin);
+        return false;
+    }
+    void skipSpace(void){
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+    bool literal(const char* word){
+        size_t n = strlen(word);
+        if (size_t(end - p) < n || memcmp(p, word, n) != 0) return fail("invalid literal");
+        p += n;
+        return true;
+    }
+    static void appendUtf8(std::string &s, uint32_t c){
+        if (c < 0x80) s += char(c);
+        else if (c < 0x800) { s += char(0xC0 | (c >> 6)); s += char(0x80 | (c & 0x3F)); }
+        else if (c < 0x10000) { s += char(0xE0 | (c >> 12)); s += char(0x80 | ((c >> 6) & 0x3F)); s += char(0x80 | (c & 0x3F)); }
+        else { s += char(0xF0 | (c >> 18)); s += char(0x80 | ((c >> 12) & 0x3F)); s += char(0x80 | ((c >> 6) & 0x3F)); s += char(0x80 | (c & 0x3F)); }
+    }
+    bool hex4(uint32_t &c){
+        if (end - p < 4) return fail("truncated escape");
+        c = 0;
+        for (int i = 0; i < 4; i++, p++) {
+            char h = *p;
+            c <<= 4;
+            if (h >= '0' && h <= '9') c |= uint32_t(h - '0');
+            else if (h >= 'a' && h <= 'f') c |= uint32_t(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F') c |= uint32_t(h - 'A' + 10);
+            else return fail("invalid escape");
+        }
+        return true;
+    }
+    bool parseString(std::string &s){
+        p++; // opening quote
+        while (true) {
+            if (p >= end) return fail("unterminated string");
+            char c = *p++;
+            if (c == '"') return true;
+            if (c != '\\') { s += c; continue; }
+            if (p >= end) return fail("unterminated string");
+            char e = *p++;
+            switch (e) {
+                case '"': s += '"'; break;
+                case '\\': s += '\\'; break;
+                case '/': s += '/'; break;
+                case 'b': s += '\b'; break;
+                case 'f': s += '\f'; break;
+                case 'n': s += '\n'; break;
+                case 'r': s += '\r'; break;
+                case 't': s += '\t'; break;
+                case 'u': {
+                    uint32_t code = 0;
+                    if (!hex4(code)) return false;
+                    // a surrogate pair encodes one code point beyond the basic plane
+                    if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        p += 2;
+                        uint32_t low = 0;
+                        if (!hex4(low)) return false;
+                        if (low >= 0xDC00 && low < 0xE000) code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(s, code);
+                    break;
+                }
+                default: return fail("invalid escape");
+            }
+        }
+    }
+    bool parseNumber(double &number){
+        const char* start = p;
+        while (p < end && *p != '\0' && strchr("+-0123456789.eE", *p) != NULL) p++;
+        std::string text(start, p);
+        char* stop = NULL;
+        number = strtod(text.c_str(), &stop);
+        if (text.empty() || stop != text.c_str() + text.size()) return fail("invalid number");
+        return true;
+    }
+    bool parse(JsonValue &v, int depth = 0){
+        if (depth > max_depth) return fail("nesting too deep");
+        skipSpace();
+        if (p >= end) return fail("unexpected end");
+        switch (*p) {
+            case '{': {
+                v.type = JsonValue::OBJECT;
+                p++;
+                skipSpace();
+                if (p < end && *p == '}') { p++; return true; }
+                while (true) {
+                    skipSpace();
+                    if (p >= end || *p != '"') return fail("expected a key");
+                    v.keys.push_back(std::string());
+                    if (!parseString(v.keys.back())) return false;
+                    skipSpace();
+                    if (p >= end || *p != ':') return fail("expected ':'");
+                    p++;
+                    v.values.push_back(JsonValue());
+                    if (!parse(v.values.back(), depth + 1)) return false;
+                    skipSpace();
+                    if (p < end && *p == ',') { p++; continue; }
+                    if (p < end && *p == '}') { p++; return true; }
+                    return fail("expected ',' or '}'");
+                }
+            }
+            case '[': {
+                v.type = JsonValue::ARRAY;
+                p++;
+                skipSpace();
+                if (p < end && *p == ']') { p++; return true; }
+                while (true) {
+                    v.values.push_back(JsonValue());
+                    if (!parse(v.values.back(), depth + 1)) return false;
+                    skipSpace();
+                    if (p < end && *p == ',') { p++; continue; }
+                    if (p < end && *p == ']') { p++; return true; }
+                    return fail("expected ',' or ']'");
+                }
+            }
+            case '"':
+                v.type = JsonValue::STRING;
+                return parseString(v.string);
+            case 't':
+                v.type = JsonValue::BOOLEAN;
+                v.boolean = true;
+                return literal("true");
+            case 'f':
+                v.type = JsonValue::BOOLEAN;
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+                v.type = JsonValue::NUMBER;
+                return parseNumber(v.number);
+        }
+    }
+};
+
+// a non-negative integer of the JSON, such as an index or a byte count
+static bool jsonSize(const JsonValue &v, size_t &n){
+    if (v.type != JsonValue::NUMBER || !(v.number >= 0.0) || v.number > 9007199254740992.0 || v.number != floor(v.number)) return false;
+    n = size_t(v.number);
+    return true;
+}
+
+// The mapped file and what was parsed of it.
+struct GLBFile {
+    std::shared_ptr<MappedFile> file;
+    JsonValue json;
+    const char* bin = NULL;  // the binary chunk, which holds buffer 0
+    size_t bin_size = 0;
+    std::string error;
+};
+
+// A typed view of elements in the binary chunk.
+struct GLBAccessor {
+    const char* data = NULL; // first element
+    size_t count = 0;
+    size_t stride = 0;       // bytes from one element to the next
+    int component_type = 0;  // 5120 byte, 5121 unsigned byte, 5122 short, 5123 unsigned short, 5125 unsigned int, 5126 float
+    int components = 0;      // 1 for SCALAR, 3 for VEC3, ...
+    bool normalized = false;
+};
+
+static size_t componentBytes(int component_type){
+    switch (component_type) {
+        case 5120: case 5121: return 1;
+        case 5122: case 5123: return 2;
+        case 5125: case 5126: return 4;
+        default: return 0;
+    }
+}
+
+static bool accessor(GLBFile &glb, const JsonValue &index, GLBAccessor &a){
+    size_t i, view_index, buffer_index = 0;
+    const JsonValue &acc = glb.json.member("accessors").at( jsonSize(index, i) ? i : size_t(-1) );
+    if (acc.isNull()) { glb.error = "missing accessor"; return false; }
+    if (!acc.member("sparse").isNull()) { glb.error = "sparse accessors are not supported"; return false; }
+    if (!jsonSize(acc.member("bufferView"), view_index)) { glb.error = "accessor without a buffer view"; return false; }
+    const JsonValue &view = glb.json.member("bufferViews").at(view_index);
+    if (view.isNull() || !jsonSize(view.member("buffer"), buffer_index)) { glb.error = "missing buffer view"; return false; }
+    if (buffer_index != 0 || !glb.json.member("buffers").at(0).member("uri").isNull() || glb.bin == NULL) {
+        glb.error = "only the binary chunk of the .glb can hold data";
+        return false;
+    }
+
+    const std::string &type = acc.member("type").string;
+    a.components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+    a.component_type = int(acc.member("componentType").numberOr(0));
+    a.normalized = acc.member("normalized").boolean;
+    size_t element = componentBytes(a.component_type) * size_t(a.components);
+    size_t view_offset = 0, view_length = 0, offset = 0;
+    if (element == 0 || !jsonSize(acc.member("count"), a.count) || !jsonSize(view.member("byteLength"), view_length)) {
+        glb.error = "invalid accessor";
+        return false;
+    }
+    jsonSize(view.member("byteOffset"), view_offset);
+    jsonSize(acc.member("byteOffset"), offset);
+    if (!jsonSize(view.member("byteStride"), a.stride)) a.stride = element;
+
+    // every element has to lie inside the view, and the view inside the chunk
+    if (a.stride < element || view_offset > glb.bin_size || view_length > glb.bin_size - view_offset
+        || offset > view_length || (a.count > 0 && view_length - offset < element)
+        || (a.count > 0 && (view_length - offset - element) / a.stride < a.count - 1)) {
+        glb.error = "accessor out of range";
+        return false;
+    }
+    a.data = glb.bin + view_offset + offset;
+    return true;
+}
+
+// component c of element i, as a float
+static float component(const GLBAccessor &a, size_t i, int c){
+    const char* p = a.data + i * a.stride + c * componentBytes(a.component_type);
+    switch (a.component_type) {
+        case 5120: { int8_t v; memcpy(&v, p, 1); return a.normalized ? max(v / 127.0f, -1.0f) : float(v); }
+        case 5121: { uint8_t v; memcpy(&v, p, 1); return a.normalized ? v / 255.0f : float(v); }
+        case 5122: { int16_t v; memcpy(&v, p, 2); return a.normalized ? max(v / 32767.0f, -1.0f) : float(v); }
+        case 5123: { uint16_t v; memcpy(&v, p, 2); return a.normalized ? v / 65535.0f : float(v); }
+        case 5125: { uint32_t v; memcpy(&v, p, 4); return float(v); }
+        default: { float v; memcpy(&v, p, 4); return v; }
+    }
+}
+
+// element i of an index accessor
+static uint32_t indexAt(const GLBAccessor &a, size_t i){
+    const char* p = a.data + i * a.stride;
+    switch (a.component_type) {
+        case 5121: { uint8_t v; memcpy(&v, p, 1); return v; }
+        case 5123: { uint16_t v; memcpy(&v, p, 2); return v; }
+        default: { uint32_t v; memcpy(&v, p, 4); return v; }
+    }
+}
+
+// Positions or normals: viewed in place when they are tightly packed floats,
+// copied into owned otherwise.
+static bool vec3Attribute(GLBFile &glb, const GLBAccessor &a, std::vector<vec3> &owned, ArrayView<vec3> &view){
+    if (a.components != 3) {
+        glb.error = "a vertex attribute is not a VEC3";
+        return false;
+    }
+    if (a.component_type == 5126 && a.stride == sizeof(vec3) && reinterpret_cast<uintptr_t>(a.data) % alignof(vec3) == 0) {
+        view = ArrayView<vec3>( reinterpret_cast<const vec3*>(a.data), a.count );
+        return true;
+    }
+    owned.resize(a.count);
+    for (size_t i = 0; i < a.count; i++) {
+        owned[i] = vec3( component(a, i, 0), component(a, i, 1), component(a, i, 2) );
+    }
+    view = owned;
+    return true;
+}
+
+static bool loadPrimitive(GLBFile &glb, const JsonValue &primitive, RTGeometry &geom){
+    if (primitive.member("mode").numberOr(4) != 4) {
+        glb.error = "only triangle primitives are supported";
+        return false;
+    }
+    const JsonValue &attributes = primitive.member("attributes");
+    GLBAccessor positions;
+    if (!accessor(glb, attributes.member("POSITION"), positions)) return false;
+    if (!vec3Attribute(glb, positions, geom.positions, geom.view.positions)) return false;
+    size_t n = geom.view.positions.size();
+
+    // triangles: three 32-bit indices are viewed in place as one uvec3
+    const JsonValue &index_accessor = primitive.member("indices");
+    if (!index_accessor.isNull()) {
+        GLBAccessor indices;
+        if (!accessor(glb, index_accessor, indices)) return false;
+        if (indices.components != 1 || indices.count % 3 != 0
+            || (indices.component_type != 5121 && indices.component_type != 5123 && indices.component_type != 5125)) {
+            glb.error = "invalid triangle indices";
+            return false;
+        }
+        if (indices.component_type == 5125 && indices.stride == 4 && reinterpret_cast<uintptr_t>(indices.data) % alignof(uvec3) == 0) {
+            geom.view.triangles = ArrayView<uvec3>( reinterpret_cast<const uvec3*>(indices.data), indices.count / 3 );
+        }
+        else {
+            geom.triangles.resize(indices.count / 3);
+            for (size_t i = 0; i < indices.count; i++) geom.triangles[i / 3][i % 3] = indexAt(indices, i);
+            geom.view.triangles = geom.triangles;
+        }
+    }
+    else {
+        if (n % 3 != 0) {
+            glb.error = "invalid vertex count";
+            return false;
+        }
+        geom.triangles.resize(n / 3);
+        for (size_t i = 0; i < n; i++) geom.triangles[i / 3][i % 3] = uint32_t(i);
+        geom.view.triangles = geom.triangles;
+    }
+    for (size_t i = 0; i < geom.triangleCount(); i++) {
+        for (int j = 0; j < 3; j++) {
+            if (geom.view.triangles[i][j] >= n) {
+                glb.error = "triangle index out of range";
+                return false;
+            }
+        }
+    }
+
+    // normals; a mesh without them gets the area-weighted average of the faces around each vertex
+    const JsonValue &normal_accessor = attributes.member("NORMAL");
+    if (!normal_accessor.isNull()) {
+        GLBAccessor normals;
+        if (!accessor(glb, normal_accessor, normals)) return false;
+        if (normals.count != n) {
+            glb.error = "normal count differs from position count";
+            return false;
+        }
+        if (!vec3Attribute(glb, normals, geom.normals, geom.view.normals)) return false;
+    }
+    else {
+        geom.normals.assign(n, vec3(0.0f));
+        for (size_t i = 0; i < geom.triangleCount(); i++) {
+            const uvec3 &tri = geom.view.triangles[i];
+            vec3 face = cross( geom.view.positions[tri[1]] - geom.view.positions[tri[0]],
+                               geom.view.positions[tri[2]] - geom.view.positions[tri[0]] );
+            for (int j = 0; j < 3; j++) geom.normals[ tri[j] ] += face;
+        }
+        for (vec3 &N : geom.normals) N = (dot(N, N) > 0.0f) ? normalize(N) : vec3(0.0f, 1.0f, 0.0f);
+        geom.view.normals = geom.normals;
+    }
+
+    geom.count = int(3 * geom.triangleCount());
+    geom.cache = glb.file; // keeps the views valid
+    return true;
+}
+
+// The metallic-roughness material of glTF, approximated by the Phong material of the scene.
+static Material* loadMaterial(const JsonValue &m, Arena &arena){
+    const JsonValue &pbr = m.member("pbrMetallicRoughness");
+    const JsonValue &factor = pbr.member("baseColorFactor");
+    vec3 base(1.0f);
+    for (int c = 0; c < 3; c++) base[c] = float( factor.at(c).numberOr(1.0) );
+    float metallic = clamp( float(pbr.member("metallicFactor").numberOr(1.0)), 0.0f, 1.0f );
+    float roughness = clamp( float(pbr.member("roughnessFactor").numberOr(1.0)), 0.0f, 1.0f );
+    const JsonValue &emissive = m.member("emissiveFactor");
+
+    Material* mat = arena.make<Material>();
+    mat -> ambient = vec4(0.1f * base, 1.0f);
+    mat -> diffuse = vec4((1.0f - metallic) * base, 1.0f);
+    mat -> specular = vec4(mix(vec3(0.04f), base, metallic), 1.0f);
+    // the Blinn-Phong exponent whose lobe is about as wide as the GGX lobe of this roughness
+    float a2 = max(roughness * roughness * roughness * roughness, 1e-4f);
+    mat -> shininess = clamp(2.0f / a2 - 2.0f, 1.0f, 1000.0f);
+    for (int c = 0; c < 3; c++) mat -> emision[c] = float( emissive.at(c).numberOr(0.0) );
+    return mat;
+}
+
+// local transform of a glTF node: its matrix, or translation * rotation * scale
+static mat4 nodeTransform(const JsonValue &node){
+    const JsonValue &matrix = node.member("matrix");
+    if (matrix.size() == 16) {
+        mat4 M(1.0f);
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) M[c][r] = float( matrix.at(4*c + r).numberOr(M[c][r]) );
+        }
+        return M;
+    }
+    const JsonValue &t = node.member("translation");
+    const JsonValue &q = node.member("rotation");
+    const JsonValue &s = node.member("scale");
+    vec3 T( float(t.at(0).numberOr(0.0)), float(t.at(1).numberOr(0.0)), float(t.at(2).numberOr(0.0)) );
+    vec3 S( float(s.at(0).numberOr(1.0)), float(s.at(1).numberOr(1.0)), float(s.at(2).numberOr(1.0)) );
+    float x = float(q.at(0).numberOr(0.0)), y = float(q.at(1).numberOr(0.0)), z = float(q.at(2).numberOr(0.0)), w = float(q.at(3).numberOr(1.0));
+    mat4 R(1.0f);
+    R[0] = vec4(1.0f - 2.0f*(y*y + z*z), 2.0f*(x*y + z*w), 2.0f*(x*z - y*w), 0.0f);
+    R[1] = vec4(2.0f*(x*y - z*w), 1.0f - 2.0f*(x*x + z*z), 2.0f*(y*z + x*w), 0.0f);
+    R[2] = vec4(2.0f*(x*z + y*w), 2.0f*(y*z - x*w), 1.0f - 2.0f*(x*x + y*y), 0.0f);
+    mat4 M = R;
+    for (int c = 0; c < 3; c++) M[c] = M[c] * S[c];
+    M[3] = vec4(T, 1.0f);
+    return M;
+}
+
+static bool readGLB(const char* path, GLBFile &glb){
+    glb.file.reset(new MappedFile());
+    if (!glb.file -> open(path)) {
+        glb.error = "cannot open file";
+        return false;
+    }
+    const char* data = glb.file -> data;
+    size_t size = glb.file -> size;
+    uint32_t header[3];
+    if (size < sizeof(header)) {
+        glb.error = "not a .glb file";
+        return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] != 0x46546C67 || header[1] != 2 || header[2] > size) { // "glTF", version 2
+        glb.error = "not a version 2 .glb file";
+        return false;
+    }
+    size = header[2];
+
+    // chunks: the JSON first, then the optional binary chunk
+    size_t at = sizeof(header);
+    bool have_json = false;
+    while (size - at >= 8) {
+        uint32_t chunk[2]; // length, type
+        memcpy(chunk, data + at, sizeof(chunk));
+        at += sizeof(chunk);
+        if (chunk[0] > size - at) {
+            glb.error = "truncated chunk";
+            return false;
+        }
+        if (chunk[1] == 0x4E4F534A && !have_json) { // "JSON"
+            JsonParser parser(data + at, chunk[0]);
+            if (!parser.parse(glb.json) || glb.json.type != JsonValue::OBJECT) {
+                glb.error = "invalid JSON chunk: " + parser.error;
+                return false;
+            }
+            have_json = true;
+        }
+        else if (chunk[1] == 0x004E4942 && glb.bin == NULL) { // "BIN"
+            glb.bin = data + at;
+            glb.bin_size = chunk[0];
+        }
+        at += chunk[0];
+    }
+    if (!have_json) {
+        glb.error = "no JSON chunk";
+        return false;
+    }
+    return true;
+}
+
+// glTF node hierarchies are strict trees: no node has two parents, and no node is its own
+// ancestor (which the scene graph could not be traversed with)
+static bool checkNodeTree(GLBFile &glb, const JsonValue &gltf_nodes){
+    const size_t n = gltf_nodes.size();
+    std::vector<int> parents(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        const JsonValue &children = gltf_nodes.at(i).member("children");
+        for (size_t c = 0; c < children.size(); c++) {
+            size_t child;
+            if (!jsonSize(children.at(c), child) || child >= n) continue;
+            if (++parents[child] > 1) {
+                glb.error = "node " + std::to_string(child) + " has two parents";
+                return false;
+            }
+        }
+    }
+
+    // depth-first search from every node; reaching a node that is still on the stack closes a cycle
+    enum { unvisited, on_stack, done };
+    std::vector<char> state(n, unvisited);
+    std::vector< std::pair<size_t, size_t> > stack; // node, and the next of its children to visit
+    for (size_t start = 0; start < n; start++) {
+        if (state[start] != unvisited) continue;
+        state[start] = on_stack;
+        stack.push_back( std::make_pair(start, size_t(0)) );
+        while (!stack.empty()) {
+            size_t i = stack.back().first;
+            const JsonValue &children = gltf_nodes.at(i).member("children");
+            if (stack.back().second == children.size()) {
+                state[i] = done;
+                stack.pop_back();
+                continue;
+            }
+            size_t child;
+            if (!jsonSize(children.at(stack.back().second++), child) || child >= n) continue;
+            if (state[child] == on_stack) {
+                glb.error = "node " + std::to_string(child) + " is its own descendant";
+                return false;
+            }
+            if (state[child] == unvisited) {
+                state[child] = on_stack;
+                stack.push_back( std::make_pair(child, size_t(0)) );
+            }
+        }
+    }
+    return true;
+}
+
+bool GLBLoader::load(const char* path, RTScene &scene, RTNode* parent, const mat4 &transform){
+    std::cout << "Loading " << path << "...";
+    GLBFile glb;
+    if (!readGLB(path, glb)) {
+        std::cout << std::endl;
+        std::cerr << "Cannot import " << path << ": " << glb.error << "." << std::endl;
+        return false;
+    }
+    const JsonValue &json = glb.json;
+    const std::string prefix = std::string(path) + ":";
+    if (scene.node.find(prefix + "scene") != Palette<RTNode>::none) {
+        std::cout << std::endl;
+        std::cerr << "Cannot import " << path << ": it is already in the scene." << std::endl;
+        return false;
+    }
+    if (!checkNodeTree(glb, json.member("nodes"))) {
+        std::cout << std::endl;
+        std::cerr << "Cannot import " << path << ": " << glb.error << "." << std::endl;
+        return false;
+    }
+
+    // Everything is made in the scene's arena first and only put into the palettes
+    // once the whole file is known to be valid.
+    std::vector<Material*> materials;
+    for (size_t i = 0; i < json.member("materials").size(); i++) {
+        materials.push_back( loadMaterial( json.member("materials").at(i), scene.arena ) );
+    }
+    Material* default_material = loadMaterial(json_null, scene.arena);
+
+    // a model per primitive of every mesh
+    std::vector<RTGeometry*> geometries;
+    std::vector<RTModel*> models;
+    std::vector< std::vector<RTModel*> > mesh_models( json.member("meshes").size() );
+    size_t triangle_count = 0;
+    for (size_t m = 0; m < mesh_models.size(); m++) {
+        const JsonValue &primitives = json.member("meshes").at(m).member("primitives");
+        for (size_t p = 0; p < primitives.size(); p++) {
+            geometries.push_back( scene.arena.make<RTGeometry>() );
+            if (!loadPrimitive(glb, primitives.at(p), *geometries.back())) {
+                std::cout << std::endl;
+                std::cerr << "Cannot import mesh " << m << " of " << path << ": " << glb.error << "." << std::endl;
+                return false;
+            }
+            triangle_count += geometries.back() -> triangleCount();
+            size_t material;
+            models.push_back( scene.arena.make<RTModel>() );
+            models.back() -> geometry = geometries.back();
+            models.back() -> material = jsonSize(primitives.at(p).member("material"), material) && material < materials.size()
+                                      ? materials[material] : default_material;
+            mesh_models[m].push_back( models.back() );
+        }
+    }
+
+    // the levels of detail of the meshes, simplified a mesh per thread
+    int chunks = std::max(1, std::min(threadCount(), int(geometries.size())));
+    parallelChunks(int(geometries.size()), chunks, [&](int c, int begin, int end) {
+        for (int g = begin; g < end; g++) geometries[g] -> buildLevels();
+    });
+
+    // a node per glTF node, under one node for the whole file
+    const JsonValue &gltf_nodes = json.member("nodes");
+    std::vector<RTNode*> nodes;
+    for (size_t i = 0; i < gltf_nodes.size(); i++) nodes.push_back( scene.arena.make<RTNode>() );
+    RTNode* root = scene.arena.make<RTNode>();
+    for (size_t i = 0; i < gltf_nodes.size(); i++) {
+        const JsonValue &node = gltf_nodes.at(i);
+        size_t mesh, child;
+        if (jsonSize(node.member("mesh"), mesh) && mesh < mesh_models.size()) {
+            for (RTModel* model : mesh_models[mesh]) {
+                nodes[i] -> models.push_back(model);
+                nodes[i] -> modeltransforms.push_back( mat4(1.0f) );
+            }
+        }
+        const JsonValue &children = node.member("children");
+        for (size_t c = 0; c < children.size(); c++) {
+            if (!jsonSize(children.at(c), child) || child >= nodes.size()) continue;
+            nodes[i] -> childnodes.push_back( nodes[child] );
+            nodes[i] -> childtransforms.push_back( nodeTransform(gltf_nodes.at(child)) );
+        }
+    }
+    size_t scene_index = 0;
+    jsonSize(json.member("scene"), scene_index);
+    const JsonValue &roots = json.member("scenes").at(scene_index).member("nodes");
+    for (size_t r = 0; r < roots.size(); r++) {
+        size_t i;
+        if (!jsonSize(roots.at(r), i) || i >= nodes.size()) continue;
+        root -> childnodes.push_back( nodes[i] );
+        root -> childtransforms.push_back( nodeTransform(gltf_nodes.at(i)) );
+    }
+
+    // hand everything over to the palettes
+    for (size_t i = 0; i < materials.size(); i++) scene.material[ prefix + "material" + std::to_string(i) ] = materials[i];
+    scene.material[ prefix + "default material" ] = default_material;
+    size_t g = 0;
+    for (size_t m = 0; m < mesh_models.size(); m++) {
+        for (size_t p = 0; p < mesh_models[m].size(); p++, g++) {
+            std::string name = prefix + "mesh" + std::to_string(m) + "/" + std::to_string(p);
+            scene.geometry[name] = geometries[g];
+            scene.model[name] = models[g];
+        }
+    }
+    for (size_t i = 0; i < nodes.size(); i++) scene.node[ prefix + "node" + std::to_string(i) ] = nodes[i];
+    parent -> childnodes.push_back( root );
+    parent -> childtransforms.push_back(transform);
+    scene.node[ prefix + "scene" ] = root;
+    scene.materials_changed = true;
+
+    std::cout << "done (" << geometries.size() << " meshes, " << triangle_count << " triangles, "
+              << nodes.size() << " nodes)." << std::endl;
+    return true;
+}
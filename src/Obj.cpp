@@ -1,109 +0,0 @@
-/**************************************************
-Obj is subclass class of Geometry
-that loads an obj file.
- This obj file loader only supports vertex positions and normals:
- v   x y z
- vn nx ny nz
- f 123//456
- i.e. there is no texture.
-*****************************************************/
-#include <stdio.h>
-#include <iostream>
-#include <string>
-#include <vector>
-#ifdef __APPLE__
-#include <OpenGL/gl3.h>
-#include <OpenGL/glext.h>
-#include <GLUT/glut.h>
-#else
-#include <GL/glew.h>
-#include <GL/glut.h>
-#endif
-
-#include "Obj.h"
-
-void Obj::init(const char * filename){
-    std::vector< glm::vec3 > temp_vertices, vertices;
-    std::vector< glm::vec3 > temp_normals, normals;
-    std::vector< unsigned int > temp_vertexIndices, indices;
-    std::vector< unsigned int > temp_normalIndices;
-    
-    // load obj file
-    FILE * file = fopen( filename , "r" );
-    if( file == NULL ){
-        std::cerr << "Cannot open file: " << filename << std::endl;
-        exit(-1);
-    }
-    std::cout << "Loading " << filename << "...";
-    while (!feof(file)){
-        char lineHeader[128];
-        // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-            break; // EOF = End Of File. Quit the loop.
-
-        // else : parse lineHeader
-        if ( strcmp( lineHeader, "v" ) == 0 ){
-            glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-            temp_vertices.push_back(vertex);
-        }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-            glm::vec3 normal;
-            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-            temp_normals.push_back(normal);
-        }else if ( strcmp( lineHeader, "f" ) == 0 ){
-            //std::string vertex1, vertex2, vertex3;
-            unsigned int vertexIndex[3], normalIndex[3];
-            fscanf(file, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2] );
-            temp_vertexIndices.push_back(vertexIndex[0]);
-            temp_vertexIndices.push_back(vertexIndex[1]);
-            temp_vertexIndices.push_back(vertexIndex[2]);
-            temp_normalIndices.push_back(normalIndex[0]);
-            temp_normalIndices.push_back(normalIndex[1]);
-            temp_normalIndices.push_back(normalIndex[2]);
-        }
-    }
-    std::cout << "done." << std::endl;
-    
-    // post processing
-    std::cout << "Processing data...";
-    unsigned int n = temp_vertexIndices.size(); // #(triangles)*3
-    vertices.resize(n);
-    normals.resize(n);
-    indices.resize(n);
-    for (unsigned int i = 0; i<n; i++){
-        indices[i] = i;
-        vertices[i] = temp_vertices[ temp_vertexIndices[i] - 1 ];
-        normals[i] = temp_normals[ temp_normalIndices[i] - 1 ];
-    }
-    std::cout << "done." << std::endl;
-    
-    // setting up buffers
-    std::cout << "Setting up buffers...";
-    glGenVertexArrays(1, &vao );
-    buffers.resize(3);
-    glGenBuffers(3, buffers.data());
-    glBindVertexArray(vao);
-    
-    // 0th attribute: position
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-    glBufferData(GL_ARRAY_BUFFER, n*sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,0,(void*)0);
-    
-    // 1st attribute: normal
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-    glBufferData(GL_ARRAY_BUFFER, n*sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,0,(void*)0);
-    
-    // indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, n*sizeof(indices[0]), &indices[0], GL_STATIC_DRAW);
-    
-    count = n;
-    glBindVertexArray(0);
-    std::cout << "done." << std::endl;
-}
-
-
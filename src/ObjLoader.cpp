@@ -0,0 +1,360 @@
+/**************************************************
+ObjLoader.cpp contains the chunked .obj parser: the
+number parsers, the parsing of one chunk of lines,
+and the merge of the chunks into an indexed mesh.
+*****************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+#include "ObjLoader.h"
+#include "RTCache.h"
+#include "Parallel.h"
+
+using namespace glm;
+
+// a chunk has at least this many bytes, so that small files are parsed by one thread
+static const size_t min_chunk_bytes = 1 << 20;
+// the normal index of a corner that has none
+static const uint32_t no_normal = 0xFFFFFFFFu;
+
+// What one chunk of the file holds.  Indices are 0-based.  A negative index of
+// the file counts back from the last position (or normal) read, so it is stored
+// relative to the first position (or normal) of the chunk, which is only known
+// once all the chunks are parsed; relative lists those entries of corners.
+struct ObjChunk {
+    const char* begin = NULL;
+    const char* end = NULL;
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<uint32_t> corners; // position and normal index of the corners of every triangle, interleaved
+    std::vector<size_t> relative;
+    bool first = false; // the chunk starts the file, so nothing is before it
+    const char* error_line = NULL; // the line that could not be read, if any
+    const char* error = NULL;
+};
+
+static inline bool isBlank(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c){
+    return unsigned(c - '0') < 10;
+}
+
+static inline const char* skipBlanks(const char* p, const char* end){
+    while (p < end && isBlank(*p)) p++;
+    return p;
+}
+
+// the powers of ten that a double holds exactly
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// [+-]digits[.digits][(e|E)[+-]digits] at p, which is moved past it
+static bool parseFloat(const char* &p, const char* end, float &value){
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '+' || *s == '-')) negative = (*s++ == '-');
+    // the first 19 digits or so, which a 64-bit integer holds
+    const uint64_t mantissa_limit = 1000000000000000000ull;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; s < end && isDigit(*s); s++, digits++) {
+        if (mantissa < mantissa_limit) mantissa = 10 * mantissa + uint64_t(*s - '0');
+        else exponent++;
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && isDigit(*s); s++, digits++) {
+            if (mantissa < mantissa_limit) {
+                mantissa = 10 * mantissa + uint64_t(*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char* e = s + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '+' || *e == '-')) negative_exponent = (*e++ == '-');
+        if (e == end || !isDigit(*e)) return false;
+        int n = 0;
+        for (; e < end && isDigit(*e); e++) {
+            if (n < 100000) n = 10 * n + (*e - '0');
+        }
+        exponent += negative_exponent ? -n : n;
+        s = e;
+    }
+    // one rounding when both the mantissa and the power of ten are exact
+    double v = double(mantissa);
+    if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+        v = exponent < 0 ? v / exact_powers_of_ten[-exponent] : v * exact_powers_of_ten[exponent];
+    }
+    else {
+        v = v * pow(10.0, double(exponent));
+    }
+    value = float(negative ? -v : v);
+    p = s;
+    return true;
+}
+
+// a nonzero [+-]digits at p, which is moved past it
+static bool parseIndex(const char* &p, const char* end, long long &index){
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '+' || *s == '-')) negative = (*s++ == '-');
+    const char* digits = s;
+    long long n = 0;
+    for (; s < end && isDigit(*s); s++) {
+        if (n < (1LL << 40)) n = 10 * n + (*s - '0');
+    }
+    if (s == digits || n == 0) return false;
+    index = negative ? -n : n;
+    p = s;
+    return true;
+}
+
+static bool parseVec3(const char* p, const char* end, vec3 &v){
+    for (int c = 0; c < 3; c++) {
+        p = skipBlanks(p, end);
+        if (!parseFloat(p, end, v[c])) return false;
+    }
+    return true;
+}
+
+// One corner of a face: its position and normal index (or no_normal), each
+// either absolute or relative to the chunk.
+struct ObjCorner {
+    uint32_t index[2];
+    bool relative[2];
+};
+
+// turns the 1-based (or negative) index of a file into an ObjCorner entry,
+// count being the number of positions or normals read in the chunk so far
+static bool resolveIndex(const ObjChunk &chunk, long long index, size_t count, uint32_t &resolved, bool &relative){
+    relative = index < 0;
+    if (relative) {
+        // a negative entry may count back into the earlier chunks; whether it goes past
+        // the first position (or normal) of the file is only known once they are merged
+        long long r = (long long)count + index;
+        if ((chunk.first && r < 0) || r < INT32_MIN || r > INT32_MAX) return false;
+        resolved = uint32_t( int32_t(r) );
+        return true;
+    }
+    if (index - 1 >= (long long)no_normal) return false;
+    resolved = uint32_t(index - 1);
+    return true;
+}
+
+// the corners of the "f" line after its tag, split into a fan of triangles
+static const char* parseFace(ObjChunk &chunk, const char* p, const char* end, std::vector<ObjCorner> &face){
+    face.clear();
+    for (p = skipBlanks(p, end); p < end; p = skipBlanks(p, end)) {
+        long long v, t, n;
+        ObjCorner corner;
+        if (!parseIndex(p, end, v)) return "invalid face";
+        if (!resolveIndex(chunk, v, chunk.positions.size(), corner.index[0], corner.relative[0])) return "index out of range";
+        corner.index[1] = no_normal;
+        corner.relative[1] = false;
+        if (p < end && *p == '/') {
+            p++;
+            // the texture coordinate is not used
+            if (p < end && *p != '/' && !parseIndex(p, end, t)) return "invalid face";
+            if (p < end && *p == '/') {
+                p++;
+                if (!parseIndex(p, end, n)) return "invalid face";
+                if (!resolveIndex(chunk, n, chunk.normals.size(), corner.index[1], corner.relative[1])) return "index out of range";
+            }
+        }
+        if (p < end && !isBlank(*p)) return "invalid face";
+        face.push_back(corner);
+    }
+    if (face.size() < 3) return "face with fewer than three corners";
+    for (size_t k = 1; k + 1 < face.size(); k++) {
+        const ObjCorner* fan[3] = { &face[0], &face[k], &face[k+1] };
+        for (int j = 0; j < 3; j++) {
+            for (int a = 0; a < 2; a++) {
+                if (fan[j] -> relative[a]) chunk.relative.push_back( chunk.corners.size() );
+                chunk.corners.push_back( fan[j] -> index[a] );
+            }
+        }
+    }
+    return NULL;
+}
+
+static void parseChunk(ObjChunk &chunk){
+    std::vector<ObjCorner> face;
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* line = p;
+        const char* line_end = static_cast<const char*>( memchr(p, '\n', chunk.end - p) );
+        if (line_end == NULL) line_end = chunk.end;
+        p = line_end < chunk.end ? line_end + 1 : chunk.end;
+
+        // the tag of the line; only v, vn and f are read
+        const char* tag = skipBlanks(line, line_end);
+        const char* s = tag;
+        while (s < line_end && !isBlank(*s)) s++;
+        size_t length = s - tag;
+        const char* error = NULL;
+        if (length == 1 && tag[0] == 'v') {
+            vec3 v;
+            if (parseVec3(s, line_end, v)) chunk.positions.push_back(v);
+            else error = "invalid vertex";
+        }
+        else if (length == 2 && tag[0] == 'v' && tag[1] == 'n') {
+            vec3 n;
+            if (parseVec3(s, line_end, n)) chunk.normals.push_back(n);
+            else error = "invalid normal";
+        }
+        else if (length == 1 && tag[0] == 'f') {
+            error = parseFace(chunk, s, line_end, face);
+        }
+        if (error != NULL) {
+            chunk.error_line = line;
+            chunk.error = error;
+            return;
+        }
+    }
+}
+
+bool ObjLoader::load(const char* path, RTGeometry &geom){
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot open file: " << path << std::endl;
+        return false;
+    }
+    std::cout << "Loading " << path << "...";
+
+    // one chunk per thread, each ending at the end of a line
+    const char* data = file.data;
+    const char* end = file.data + file.size;
+    int chunks = int( std::max<size_t>(1, std::min<size_t>(threadCount(), file.size / min_chunk_bytes)) );
+    std::vector<ObjChunk> parts(chunks);
+    const char* at = data;
+    for (int c = 0; c < chunks; c++) {
+        parts[c].begin = at;
+        parts[c].first = (c == 0);
+        const char* cut = std::max(at, data + file.size / chunks * (c + 1));
+        const char* newline = c + 1 < chunks ? static_cast<const char*>( memchr(cut, '\n', end - cut) ) : NULL;
+        at = newline != NULL ? newline + 1 : end;
+        parts[c].end = at;
+    }
+    parallelChunks(chunks, chunks, [&](int c, int, int){ parseChunk(parts[c]); });
+    for (const ObjChunk &part : parts) {
+        if (part.error == NULL) continue;
+        std::cout << std::endl;
+        std::cerr << "Cannot load " << path << ": " << part.error << " on line "
+                  << 1 + std::count(data, part.error_line, '\n') << "." << std::endl;
+        return false;
+    }
+
+    // where the arrays of every chunk go in the arrays of the whole file
+    std::vector<size_t> position_start(chunks + 1, 0), normal_start(chunks + 1, 0), corner_start(chunks + 1, 0);
+    for (int c = 0; c < chunks; c++) {
+        position_start[c+1] = position_start[c] + parts[c].positions.size();
+        normal_start[c+1] = normal_start[c] + parts[c].normals.size();
+        corner_start[c+1] = corner_start[c] + parts[c].corners.size();
+    }
+    const size_t position_count = position_start[chunks];
+    const size_t normal_count = normal_start[chunks];
+    const size_t corner_count = corner_start[chunks];
+    if (position_count + normal_count >= no_normal) {
+        std::cout << std::endl;
+        std::cerr << "Cannot load " << path << ": too many vertices." << std::endl;
+        return false;
+    }
+    std::vector<vec3> positions(position_count), normals(normal_count);
+    std::vector<uint32_t> corners(corner_count);
+    std::vector<char> out_of_range(chunks, 0);
+    parallelChunks(chunks, chunks, [&](int c, int, int){
+        ObjChunk &part = parts[c];
+        std::copy(part.positions.begin(), part.positions.end(), positions.begin() + position_start[c]);
+        std::copy(part.normals.begin(), part.normals.end(), normals.begin() + normal_start[c]);
+        uint32_t* out = corners.data() + corner_start[c];
+        std::copy(part.corners.begin(), part.corners.end(), out);
+        for (size_t i : part.relative) {
+            long long r = (long long)int32_t(out[i]) + (long long)(i % 2 == 0 ? position_start[c] : normal_start[c]);
+            if (r < 0 || r >= (long long)(i % 2 == 0 ? position_count : normal_count)) {
+                out_of_range[c] = 1; // before the first one, or it would read as no_normal
+                r = 0;
+            }
+            out[i] = uint32_t(r);
+        }
+        for (size_t i = 0; i < part.corners.size(); i += 2) {
+            if (out[i] >= position_count || (out[i+1] != no_normal && out[i+1] >= normal_count)) out_of_range[c] = 1;
+        }
+        std::vector<vec3>().swap(part.positions);
+        std::vector<vec3>().swap(part.normals);
+        std::vector<uint32_t>().swap(part.corners);
+    });
+    if (std::count(out_of_range.begin(), out_of_range.end(), 1) > 0) {
+        std::cout << std::endl;
+        std::cerr << "Cannot load " << path << ": a face refers to a vertex or normal that does not exist." << std::endl;
+        return false;
+    }
+    std::cout << "done." << std::endl;
+
+    std::cout << "Processing data...";
+    // a corner without a normal gets the area-weighted normal of the faces around its position
+    bool missing = false;
+    for (size_t i = 1; i < corner_count && !missing; i += 2) missing = corners[i] == no_normal;
+    if (missing) {
+        std::vector<vec3> smooth(position_count, vec3(0.0f));
+        for (size_t i = 0; i < corner_count; i += 6) {
+            const vec3 &a = positions[ corners[i] ], &b = positions[ corners[i+2] ], &c = positions[ corners[i+4] ];
+            vec3 n = cross(b - a, c - a);
+            for (int j = 0; j < 3; j++) {
+                if (corners[i + 2*j + 1] == no_normal) smooth[ corners[i + 2*j] ] += n;
+            }
+        }
+        normals.reserve(normal_count + position_count);
+        for (const vec3 &n : smooth) normals.push_back( dot(n, n) > 0.0f ? normalize(n) : vec3(0.0f, 0.0f, 1.0f) );
+        for (size_t i = 1; i < corner_count; i += 2) {
+            if (corners[i] == no_normal) corners[i] = uint32_t(normal_count + corners[i-1]);
+        }
+    }
+
+    // A vertex is a distinct (position, normal) pair of the corners, so that every
+    // triangle is three indices into shared vertex arrays.  When every position
+    // comes with the same normal, the pairs need no lookup: that is the case of
+    // files that number normals like positions (v//v) or have no normals.
+    std::vector<vec3> vertex_positions, vertex_normals;
+    std::vector<uvec3> triangles(corner_count / 6);
+    uint32_t shift = corner_count > 0 ? corners[1] - corners[0] : 0;
+    bool paired = size_t(shift) + position_count <= normals.size();
+    for (size_t i = 0; i < corner_count && paired; i += 2) paired = corners[i+1] - corners[i] == shift;
+    if (paired) {
+        vertex_positions.swap(positions);
+        vertex_normals.assign(normals.begin() + shift, normals.begin() + shift + position_count);
+        for (size_t i = 0; i < corner_count; i += 2) triangles[i / 6][(i / 2) % 3] = corners[i];
+    }
+    else {
+        std::unordered_map< uint64_t, uint32_t > vertex_of_pair;
+        vertex_of_pair.reserve(corner_count / 2);
+        for (size_t i = 0; i < corner_count; i += 2) {
+            uint64_t pair = (uint64_t(corners[i]) << 32) | corners[i+1];
+            std::pair< std::unordered_map< uint64_t, uint32_t >::iterator, bool > found =
+                vertex_of_pair.insert( std::make_pair(pair, uint32_t(vertex_positions.size())) );
+            if (found.second) {
+                vertex_positions.push_back( positions[ corners[i] ] );
+                vertex_normals.push_back( normals[ corners[i+1] ] );
+            }
+            triangles[i / 6][(i / 2) % 3] = found.first -> second;
+        }
+    }
+    geom.positions.swap(vertex_positions);
+    geom.normals.swap(vertex_normals);
+    geom.triangles.swap(triangles);
+    geom.updateView();
+    std::cout << "done (" << geom.positions.size() << " vertices, " << geom.triangles.size() << " triangles)." << std::endl;
+    return true;
+}
@@ -0,0 +1,308 @@
+/**************************************************
+RTCache.cpp contains the reading and writing of the
+model cache files, and the memory mapping they are
+loaded with.
+*****************************************************/
+#include "RTCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool MappedFile::open(const char* path){
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    // a shared read-only mapping lets every process that maps the file use the same pages
+    void* p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data = static_cast<const char*>(p);
+    size = size_t(st.st_size);
+    return true;
+}
+
+void MappedFile::close(void){
+    if (data != NULL) munmap(const_cast<char*>(data), size);
+    data = NULL;
+    size = 0;
+}
+
+MappedFile::~MappedFile(){
+    close();
+}
+
+// Sections of a cache file, in file order.  Each starts on a 64-byte
+// boundary, which keeps the cache-line aligned BVH nodes aligned in memory.
+enum CacheSection {
+    SECTION_POSITIONS,
+    SECTION_NORMALS,
+    SECTION_TRIANGLES,
+    SECTION_NODES,
+    SECTION_INDICES,
+    SECTION_NODES4,
+    SECTION_NODES8,
+    SECTION_QNODES4,
+    SECTION_QNODES8,
+    SECTION_LEVELS,
+    SECTION_LEVEL_TRIANGLES,
+    SECTION_COUNT
+};
+
+// a level of detail of the mesh: a range of the level triangles
+struct CacheLevel {
+    uint64_t first;
+    uint64_t count;
+    float error;
+    uint32_t padding;
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t source_hash;
+    // element sizes, so a file written by a build with another struct layout is rejected
+    uint32_t element_bytes[SECTION_COUNT];
+    int32_t bvh_width;
+    int32_t bvh_quantized;
+    int32_t bvh_mode;
+    float bvh_build_cost;
+    int32_t bvh_leaf_alignment;
+    int32_t bvh_primitive_count;
+    uint64_t offset[SECTION_COUNT];
+    uint64_t count[SECTION_COUNT];
+};
+
+static const char cache_magic[8] = {'R', 'T', 'C', 'A', 'C', 'H', 'E', '\0'};
+static const size_t section_alignment = 64;
+
+static void elementBytes(uint32_t *bytes){
+    bytes[SECTION_POSITIONS] = sizeof(glm::vec3);
+    bytes[SECTION_NORMALS] = sizeof(glm::vec3);
+    bytes[SECTION_TRIANGLES] = sizeof(glm::uvec3);
+    bytes[SECTION_NODES] = sizeof(BVHNode);
+    bytes[SECTION_INDICES] = sizeof(int);
+    bytes[SECTION_NODES4] = sizeof(WideBVHNode<4>);
+    bytes[SECTION_NODES8] = sizeof(WideBVHNode<8>);
+    bytes[SECTION_QNODES4] = sizeof(QuantizedBVHNode<4>);
+    bytes[SECTION_QNODES8] = sizeof(QuantizedBVHNode<8>);
+    bytes[SECTION_LEVELS] = sizeof(CacheLevel);
+    bytes[SECTION_LEVEL_TRIANGLES] = sizeof(glm::uvec3);
+}
+
+bool RTCache::hashFile(const char* path, uint64_t &hash){
+    // FNV-1a over 8-byte words, then the remaining bytes and the length
+    const uint64_t prime = 1099511628211ULL;
+    hash = 14695981039346656037ULL;
+    MappedFile file;
+    if (!file.open(path)) return false;
+    size_t words = file.size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, file.data + 8*i, 8);
+        hash = (hash ^ w) * prime;
+    }
+    for (size_t i = 8*words; i < file.size; i++) {
+        hash = (hash ^ uint8_t(file.data[i])) * prime;
+    }
+    hash = (hash ^ uint64_t(file.size)) * prime;
+    return true;
+}
+
+std::string RTCache::cachePath(const std::string &source){
+    return source + ".rtcache";
+}
+
+bool RTCache::load(RTGeometry &geom){
+    geom.source_hash = 0;
+    if (geom.source.empty() || !hashFile(geom.source.c_str(), geom.source_hash)) return false;
+
+    std::string path = cachePath(geom.source);
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file -> open(path.c_str())) return false;
+    if (file -> size < sizeof(CacheHeader)) return false;
+
+    CacheHeader header;
+    memcpy(&header, file -> data, sizeof(header));
+    uint32_t bytes[SECTION_COUNT];
+    elementBytes(bytes);
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != version
+        || header.header_bytes != sizeof(CacheHeader) || header.source_hash != geom.source_hash
+        || memcmp(header.element_bytes, bytes, sizeof(bytes)) != 0 || header.bvh_leaf_alignment != triangle_block_width) {
+        std::cout << "Cache " << path << " is out of date." << std::endl;
+        return false;
+    }
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        if (header.offset[s] % section_alignment != 0 || header.offset[s] > file -> size
+            || header.count[s] > (file -> size - header.offset[s]) / bytes[s]) {
+            std::cerr << "Cache " << path << " is truncated." << std::endl;
+            return false;
+        }
+    }
+
+    const char *base = file -> data;
+    if (header.count[SECTION_NORMALS] != header.count[SECTION_POSITIONS]) {
+        std::cerr << "Cache " << path << " is corrupt." << std::endl;
+        return false;
+    }
+    const glm::uvec3 *triangles = reinterpret_cast<const glm::uvec3*>(base + header.offset[SECTION_TRIANGLES]);
+    size_t n = size_t(header.count[SECTION_TRIANGLES]);
+    const glm::uvec3 *level_triangles = reinterpret_cast<const glm::uvec3*>(base + header.offset[SECTION_LEVEL_TRIANGLES]);
+    size_t level_n = size_t(header.count[SECTION_LEVEL_TRIANGLES]);
+    const CacheLevel *levels = reinterpret_cast<const CacheLevel*>(base + header.offset[SECTION_LEVELS]);
+    size_t level_count = size_t(header.count[SECTION_LEVELS]);
+    bool corrupt = false;
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) corrupt = corrupt || triangles[i][j] >= header.count[SECTION_POSITIONS];
+    }
+    for (size_t i = 0; i < level_n; i++) {
+        for (int j = 0; j < 3; j++) corrupt = corrupt || level_triangles[i][j] >= header.count[SECTION_POSITIONS];
+    }
+    for (size_t l = 0; l < level_count; l++) {
+        corrupt = corrupt || levels[l].first > level_n || levels[l].count > level_n - levels[l].first;
+    }
+    if (corrupt) {
+        std::cerr << "Cache " << path << " is corrupt." << std::endl;
+        return false;
+    }
+
+    BVH bvh;
+    bvh.width = header.bvh_width;
+    bvh.quantized = header.bvh_quantized != 0;
+    bvh.mode = BVHBuildMode(header.bvh_mode);
+    bvh.build_cost = header.bvh_build_cost;
+    bvh.leaf_alignment = header.bvh_leaf_alignment;
+    bvh.primitive_count = header.bvh_primitive_count;
+    bvh.view.nodes = ArrayView<BVHNode>( reinterpret_cast<const BVHNode*>(base + header.offset[SECTION_NODES]), header.count[SECTION_NODES] );
+    bvh.view.indices = ArrayView<int>( reinterpret_cast<const int*>(base + header.offset[SECTION_INDICES]), header.count[SECTION_INDICES] );
+    bvh.view.nodes4 = ArrayView< WideBVHNode<4> >( reinterpret_cast<const WideBVHNode<4>*>(base + header.offset[SECTION_NODES4]), header.count[SECTION_NODES4] );
+    bvh.view.nodes8 = ArrayView< WideBVHNode<8> >( reinterpret_cast<const WideBVHNode<8>*>(base + header.offset[SECTION_NODES8]), header.count[SECTION_NODES8] );
+    bvh.view.qnodes4 = ArrayView< QuantizedBVHNode<4> >( reinterpret_cast<const QuantizedBVHNode<4>*>(base + header.offset[SECTION_QNODES4]), header.count[SECTION_QNODES4] );
+    bvh.view.qnodes8 = ArrayView< QuantizedBVHNode<8> >( reinterpret_cast<const QuantizedBVHNode<8>*>(base + header.offset[SECTION_QNODES8]), header.count[SECTION_QNODES8] );
+    if (bvh.primitive_count != int(n) || !bvh.valid()) {
+        std::cerr << "Cache " << path << " is corrupt." << std::endl;
+        return false;
+    }
+
+    // The mesh and the BVH are used in place.
+    geom.bvh = std::move(bvh);
+    geom.positions.clear();
+    geom.normals.clear();
+    geom.triangles.clear();
+    geom.view.positions = ArrayView<glm::vec3>( reinterpret_cast<const glm::vec3*>(base + header.offset[SECTION_POSITIONS]), header.count[SECTION_POSITIONS] );
+    geom.view.normals = ArrayView<glm::vec3>( reinterpret_cast<const glm::vec3*>(base + header.offset[SECTION_NORMALS]), header.count[SECTION_NORMALS] );
+    geom.view.triangles = ArrayView<glm::uvec3>( triangles, n );
+    geom.count = int(3 * n);
+    geom.levels.clear();
+    geom.levels.resize(level_count);
+    for (size_t l = 0; l < level_count; l++) {
+        geom.levels[l].view = ArrayView<glm::uvec3>( level_triangles + levels[l].first, size_t(levels[l].count) );
+        geom.levels[l].error = levels[l].error;
+    }
+
+    geom.cache = file;
+    geom.packBlocks();
+
+    std::cout << "Loaded " << n << " triangles, their BVH and " << level_count << " levels of detail from " << path << "." << std::endl;
+    return true;
+}
+
+void RTCache::save(const RTGeometry &geom){
+    if (geom.source.empty() || geom.bvh.empty()) return;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = version;
+    header.header_bytes = sizeof(CacheHeader);
+    header.source_hash = geom.source_hash;
+    elementBytes(header.element_bytes);
+    const BVH &bvh = geom.bvh;
+    header.bvh_width = bvh.width;
+    header.bvh_quantized = bvh.quantized ? 1 : 0;
+    header.bvh_mode = int32_t(bvh.mode);
+    header.bvh_build_cost = bvh.build_cost;
+    header.bvh_leaf_alignment = bvh.leaf_alignment;
+    header.bvh_primitive_count = bvh.primitive_count;
+
+    // the triangles of all the levels of detail, one after the other
+    std::vector<CacheLevel> levels( geom.levels.size() );
+    std::vector<glm::uvec3> level_triangles;
+    for (size_t l = 0; l < levels.size(); l++) {
+        const ArrayView<glm::uvec3> &tris = geom.levels[l].view;
+        memset(&levels[l], 0, sizeof(CacheLevel));
+        levels[l].first = level_triangles.size();
+        levels[l].count = tris.size();
+        levels[l].error = geom.levels[l].error;
+        level_triangles.insert(level_triangles.end(), tris.data, tris.data + tris.size());
+    }
+
+    const char* data[SECTION_COUNT] = {
+        reinterpret_cast<const char*>(geom.view.positions.data),
+        reinterpret_cast<const char*>(geom.view.normals.data),
+        reinterpret_cast<const char*>(geom.view.triangles.data),
+        reinterpret_cast<const char*>(bvh.view.nodes.data),
+        reinterpret_cast<const char*>(bvh.view.indices.data),
+        reinterpret_cast<const char*>(bvh.view.nodes4.data),
+        reinterpret_cast<const char*>(bvh.view.nodes8.data),
+        reinterpret_cast<const char*>(bvh.view.qnodes4.data),
+        reinterpret_cast<const char*>(bvh.view.qnodes8.data),
+        reinterpret_cast<const char*>(levels.data()),
+        reinterpret_cast<const char*>(level_triangles.data())
+    };
+    header.count[SECTION_POSITIONS] = geom.view.positions.size();
+    header.count[SECTION_NORMALS] = geom.view.normals.size();
+    header.count[SECTION_TRIANGLES] = geom.view.triangles.size();
+    header.count[SECTION_NODES] = bvh.view.nodes.size();
+    header.count[SECTION_INDICES] = bvh.view.indices.size();
+    header.count[SECTION_NODES4] = bvh.view.nodes4.size();
+    header.count[SECTION_NODES8] = bvh.view.nodes8.size();
+    header.count[SECTION_QNODES4] = bvh.view.qnodes4.size();
+    header.count[SECTION_QNODES8] = bvh.view.qnodes8.size();
+    header.count[SECTION_LEVELS] = levels.size();
+    header.count[SECTION_LEVEL_TRIANGLES] = level_triangles.size();
+    uint64_t offset = sizeof(CacheHeader);
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        offset = (offset + section_alignment - 1) / section_alignment * section_alignment;
+        header.offset[s] = offset;
+        offset += header.count[s] * header.element_bytes[s];
+    }
+
+    // Write to a temporary file first and rename it, so that another process
+    // never maps a half-written cache.
+    std::string path = cachePath(geom.source);
+    std::ostringstream tmp_path;
+    tmp_path << path << ".tmp" << getpid();
+    std::ofstream out(tmp_path.str().c_str(), std::ios::binary);
+    if (!out) {
+        std::cerr << "Cannot write cache file: " << tmp_path.str() << std::endl;
+        return;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t pos = sizeof(header);
+    const char zeros[section_alignment] = {0};
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        out.write(zeros, std::streamsize(header.offset[s] - pos));
+        out.write(data[s], std::streamsize(header.count[s] * header.element_bytes[s]));
+        pos = header.offset[s] + header.count[s] * header.element_bytes[s];
+    }
+    out.close();
+    if (!out || rename(tmp_path.str().c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write cache file: " << path << std::endl;
+        remove(tmp_path.str().c_str());
+        return;
+    }
+    std::cout << "Saved " << path << "." << std::endl;
+}
@@ -4,8 +4,15 @@ Scene.cpp contains the implementation of the draw command
 #include "RTScene.h"
 #include "RTCube.h"
 #include "RTObj.h"
+#include "RTCache.h"
+#include "Parallel.h"
+#include "GLBLoader.h"
 
 #include <glm/gtx/string_cast.hpp>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // The scene init definition 
 #include "RTScene.inl"
@@ -13,35 +20,198 @@ Scene.cpp contains the implementation of the draw command
 
 using namespace glm;
 
-void RTScene::buildTriangleSoup() {
-    camera -> computeMatrices();
+// prints the statistics of the last build of bvh
+static void printBuildStats(const BVH &bvh, const char* name) {
+    std::cout << name << " BVH built with " << bvh.modeName() << " over " << bvh.primitive_count
+              << " primitives in " << bvh.build_time << " ms, SAH cost " << bvh.build_cost << std::endl;
+    std::cout << name << " BVH uses " << bvh.bytes() << " bytes (" << float(bvh.bytes()) / bvh.primitive_count
+              << " bytes/primitive) in " << bvh.width << "-wide" << (bvh.quantized ? " quantized" : "") << " nodes" << std::endl;
+}
+
+void RTScene::refitOrBuild(BVH &bvh, const std::vector<AABB> &bounds, const char* name) {
+    if (bvh.empty() || bvh.primitive_count != int(bounds.size()) || bvh.width != bvh_width || bvh.mode != bvh_mode
+        || bvh.quantized != bvh_quantized) {
+        bvh.width = bvh_width;
+        bvh.mode = bvh_mode;
+        bvh.quantized = bvh_quantized;
+        bvh.build(bounds);
+        printBuildStats(bvh, name);
+        return;
+    }
+    // refit to the new primitive boxes, or rebuild when the refitted tree got too slow
+    bvh.refit(bounds);
+    float refit_cost = bvh.cost();
+    if (refit_cost > refit_threshold * bvh.build_cost) {
+        std::cout << name << " BVH refit SAH cost " << refit_cost << " exceeds threshold." << std::endl;
+        bvh.build(bounds);
+        printBuildStats(bvh, name);
+    }
+    else {
+        std::cout << name << " BVH refitted (SAH cost " << refit_cost << ", built " << bvh.build_cost << ")." << std::endl;
+    }
+}
+
+void RTInstance::setTransform(const mat4 &model_matrix) {
+    M = model_matrix;
+    M_inv = inverse(M);
+    N = inverse(transpose(mat3(M)));
+    scale = max( length(vec3(M[0])), max( length(vec3(M[1])), length(vec3(M[2])) ) );
     
-    // reset triangle_soup
-    triangle_soup.clear();
+    //world bounding box from the 8 corners of the model's bounding box
+    const AABB &model_box = model -> geometry -> bvh.view.nodes[0].box;
+    box = AABB();
+    for (int c = 0; c < 8; c++) {
+        vec3 corner = vec3( (c & 1) ? model_box.max.x : model_box.min.x,
+                            (c & 2) ? model_box.max.y : model_box.min.y,
+                            (c & 4) ? model_box.max.z : model_box.min.z );
+        vec4 tempPos = M * vec4(corner, 1.0f);
+        box.grow( vec3(tempPos) / tempPos[3] );
+    }
+}
+
+void RTScene::init(const char* path) {
+    if (!GLBLoader::load(path, *this, world)) exit(-1);
     
-    // Define stacks for depth-first search (DFS)
-    std::stack < RTNode* > dfs_stack;
-    std::stack < mat4 >  matrix_stack;
+    // one light from the same direction as the sun of the built-in scene
+    light["sun"] = arena.make<Light>();
+    light["sun"] -> position = vec4(0.0f, 2.0f, 1.0f, 0.0f);
+    light["sun"] -> color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
     
-    // Initialize the current state variable for DFS
-    RTNode* cur = node["world"]; // root of the tree
-    mat4 cur_M = mat4(1.0f);
+    // bounding box of the scene, from the model boxes of its instances
+    traverseGraph();
+    AABB box = bounds();
+    if (!(box.min.x <= box.max.x)) box.grow( vec3(0.0f) );
+    
+    // Put a camera that sees the whole box from the front
+    camera = arena.make<Camera>();
+    vec3 center = 0.5f * (box.min + box.max);
+    float radius = max(0.5f * length(box.max - box.min), 1e-3f);
+    float distance = radius / std::sin(0.5f * camera -> fovy_default * float(M_PI) / 180.0f);
+    camera -> target_default = center;
+    camera -> eye_default = center + distance * normalize(vec3(0.0f, 0.3f, 1.0f));
+    camera -> up_default = vec3( 0.0f, 1.0f, 0.0f );
+    camera -> far_default = distance + 2.0f * radius;
+    camera -> near_default = 1e-4f * camera -> far_default;
+    camera -> reset();
+}
+
+AABB RTScene::bounds() {
+    std::map< const RTGeometry*, AABB > model_box;
+    for ( const RTGeometry* geom : geometry ) {
+        for (size_t i = 0; i < geom -> view.positions.size(); i++) model_box[geom].grow( geom -> view.positions[i] );
+    }
+    AABB box;
+    for ( const RTVisit &visit : visits ) {
+        for ( size_t i = 0; i < visit.node -> models.size(); i++ ){
+            const AABB &b = model_box[ visit.node -> models[i] -> geometry ];
+            if (!(b.min.x <= b.max.x)) continue; // empty mesh
+            mat4 M = visit.M * (visit.node -> modeltransforms[i]);
+            for (int c = 0; c < 8; c++) {
+                vec4 corner = M * vec4( (c & 1) ? b.max.x : b.min.x, (c & 2) ? b.max.y : b.min.y, (c & 4) ? b.max.z : b.min.z, 1.0f );
+                box.grow( vec3(corner) / corner[3] );
+            }
+        }
+    }
+    return box;
+}
+
+void RTScene::build() {
+    // the scratch of the last build is not needed anymore
+    frame_arena.reset();
+    camera -> computeMatrices();
     
-    dfs_stack.push(cur);
-    matrix_stack.push(cur_M);
+    // a change of the graph's structure, of the materials or of the settings rebuilds everything;
+    // buildInstances and buildTriangleSoup still reuse the BVHs that these settings allow
+    bool full = !built || built_instancing != instancing || built_out_of_core != out_of_core || materials_changed;
+    const BVH &built_bvh = out_of_core ? clusters.bvh : instancing ? tlas : bvh;
+    full = full || built_bvh.width != bvh_width || built_bvh.mode != bvh_mode || built_bvh.quantized != bvh_quantized;
+    for ( RTNode* n : node ) {
+        full = full || n -> childnodes != n -> built_childnodes || n -> models != n -> built_models;
+    }
+    
+    if (full) {
+        if (materials_changed) buildMaterialTable();
+        traverseGraph();
+    }
+    bool changed = full || updateVisits();
+    if (changed && out_of_core && !buildClusters()) {
+        // the clusters could not be written: the whole scene is built in memory instead
+        std::cerr << "Building the scene in memory instead." << std::endl;
+        out_of_core = false;
+        full = true;
+    }
+    if (changed && !out_of_core) {
+        if (full) {
+            if (instancing) buildInstances();
+            else buildTriangleSoup();
+            clusters.close(); // unmaps the file of an earlier out-of-core build
+        }
+        else if (instancing) updateInstances();
+        else updateTriangleSoup();
+    }
+    //the coarser levels of detail are only traced by secondary rays, so their BVHs wait until they are
+    if (instancing && !out_of_core && secondary_lod > 0) buildLevelBVHs();
+    
+    for ( RTNode* n : node ) {
+        n -> changed = false;
+    }
+    materials_changed = false;
+    built = true;
+    built_instancing = instancing;
+    built_out_of_core = out_of_core;
+}
+
+void RTScene::buildMaterialTable() {
+    // one entry per material of the palette, in palette order; a model's material
+    // that is not in the palette gets an entry of its own
+    materials.clear();
+    std::map< const Material*, MaterialId > id;
+    for ( const Material* m : material ) {
+        if (id.count(m)) continue;
+        id[m] = MaterialId(materials.size());
+        materials.push_back(*m);
+    }
+    for ( RTModel* m : model ) {
+        const Material* mat = m -> material;
+        if (!id.count(mat)) {
+            id[mat] = MaterialId(materials.size());
+            materials.push_back(mat ? *mat : Material());
+        }
+        m -> material_id = id[mat];
+    }
+    if (materials.size() > size_t(std::numeric_limits<MaterialId>::max()) + 1) {
+        std::cerr << "Error: The scene has more than " << size_t(std::numeric_limits<MaterialId>::max()) + 1 << " materials." << std::endl;
+        exit(-1);
+    }
+}
+
+void RTScene::traverseGraph() {
+    visits.clear();
     
     // Compute total number of connectivities in the graph; this would be an upper bound for
     // the stack size in the depth first search over the directed acyclic graph
-    int total_number_of_edges = 0;
+    size_t total_number_of_edges = 0;
 
-    for ( const auto &n : node ) {
-        total_number_of_edges += n.second->childnodes.size();
+    for ( RTNode* n : node ) {
+        total_number_of_edges += n -> childnodes.size();
     }
     
+    // Define stack for depth-first search (DFS), sized once in the frame arena
+    ArenaVector < RTVisit > dfs_stack( (ArenaAllocator<RTVisit>(frame_arena)) );
+    dfs_stack.reserve( total_number_of_edges + 1 );
+    
+    // Initialize the current state variable for DFS
+    RTVisit root;
+    root.node = world; // root of the tree
+    root.parent = -1;
+    root.child_index = -1;
+    root.M = mat4(1.0f);
+    root.changed = true;
+    dfs_stack.push_back(root);
+    
     // If you want to print some statistics of your scene graph
 //    std::cout << "total numb of nodes = " << node.size() << std::endl;
 //    std::cout << "total number of edges = " << total_number_of_edges << std::endl;
-//    std::cout << "triangle_soup size: " << triangle_soup.size() << std::endl;
     
     while( ! dfs_stack.empty() ){
         // Detect whether the search runs into infinite loop by checking whether the stack is longer than the number of edges in the graph.
@@ -50,52 +220,393 @@ void RTScene::buildTriangleSoup() {
             exit(-1);
         }
         
-        // top-pop the stacks
-        cur = dfs_stack.top();  dfs_stack.pop();
-        cur_M = matrix_stack.top();  matrix_stack.pop();
-                
-        //join triangle lists from all the models at the current node
-        for ( size_t i = 0; i < cur -> models.size(); i++ ){
-            //add triangles to triangle soup (transformed)
-            std::vector<Triangle> triangles = ( cur -> models[i] ) -> geometry -> elements;
-                                    
-            //transform all triangles from model coordinate to same coordinate system
-            for (Triangle tri : triangles) {
-                //in world coordinate system
-                mat4 tempMatrix = cur_M * (cur -> modeltransforms[i]);
-                mat3 M_block = mat3(tempMatrix[0][0],tempMatrix[0][1],tempMatrix[0][2],
-                                     tempMatrix[1][0],tempMatrix[1][1],tempMatrix[1][2],
-                                     tempMatrix[2][0],tempMatrix[2][1],tempMatrix[2][2]);
-
-                for (size_t j=0; j<3; j++) {
-                    vec4 tempPos = tempMatrix * vec4(tri.P[j], 1.0f);
-                                        
-                    //transform positions
-                    tri.P[j] = vec3(tempPos[0]/tempPos[3], tempPos[1]/tempPos[3], tempPos[2]/tempPos[3]);
-
-                    //transform normals
-                    tri.N[j] = normalize(inverse(transpose(M_block)) * normalize(tri.N[j]));
-                }
-
-                //add material to triangle
-                tri.material = ( cur -> models[i] ) -> material;
-
-                triangle_soup.push_back(tri);
-            }
-            
-        }
+        // top-pop the stack
+        RTVisit cur = dfs_stack.back();  dfs_stack.pop_back();
+        int cur_idx = int(visits.size());
+        visits.push_back(cur);
         
         // Continue the DFS: put all the child nodes of the current node in the stack
-        for ( size_t i = 0; i < cur -> childnodes.size(); i++ ){
-            dfs_stack.push( cur -> childnodes[i] );
-            matrix_stack.push( cur_M * (cur -> childtransforms[i]) );
+        for ( size_t i = 0; i < cur.node -> childnodes.size(); i++ ){
+            RTVisit child;
+            child.node = cur.node -> childnodes[i];
+            child.parent = cur_idx;
+            child.child_index = int(i);
+            child.M = cur.M * (cur.node -> childtransforms[i]);
+            child.changed = true;
+            dfs_stack.push_back(child);
         }
         
     } // End of DFS while loop.
     
+    // remember the structure the visits were made for
+    for ( RTNode* n : node ) {
+        n -> built_childnodes = n -> childnodes;
+        n -> built_models = n -> models;
+    }
+}
+
+bool RTScene::updateVisits() {
+    // parents come before their children, so a new transform reaches the whole subtree in one pass;
+    // a visit changed if its own node did (its model transforms) or if its matrix moved
+    bool any = false;
+    for (RTVisit &v : visits) {
+        if (v.parent >= 0) {
+            const RTVisit &parent = visits[v.parent];
+            mat4 M = parent.M * (parent.node -> childtransforms[v.child_index]);
+            v.changed = v.node -> changed || M != v.M;
+            v.M = M;
+        }
+        else {
+            v.changed = v.node -> changed;
+        }
+        any = any || v.changed;
+    }
+    return any;
+}
+
+size_t RTScene::buildSoupRanges() {
+    // one range of the soup per model of every visit
+    soup_ranges.clear();
+    size_t total = 0;
+    for (size_t v = 0; v < visits.size(); v++) {
+        RTNode* cur = visits[v].node;
+        for ( size_t i = 0; i < cur -> models.size(); i++ ){
+            RTSoupRange range;
+            range.visit = int(v);
+            range.model_index = int(i);
+            range.first = total;
+            soup_ranges.push_back(range);
+            total += cur -> models[i] -> geometry -> triangleCount();
+        }
+    }
+    return total;
+}
+
+void RTScene::buildTriangleSoup() {
+    size_t total = buildSoupRanges();
+    triangle_soup.resize(total);
+    std::vector<size_t> all( soup_ranges.size() );
+    for (size_t r = 0; r < all.size(); r++) all[r] = r;
+    flattenModels(all, triangle_soup);
+    
     std::cout << "Finished building triangle soup." << std::endl;
     std::cout << "triangle_soup size: " << triangle_soup.size() << std::endl;
 
+    buildBVH();
 }
 
+void RTScene::updateTriangleSoup() {
+    // only the models below a changed node move
+    std::vector<size_t> moved;
+    for (size_t r = 0; r < soup_ranges.size(); r++) {
+        if (visits[ soup_ranges[r].visit ].changed) moved.push_back(r);
+    }
+    flattenModels(moved, triangle_soup);
+    std::cout << "Updated " << moved.size() << " of " << soup_ranges.size() << " models in the triangle soup." << std::endl;
+    
+    buildBVH();
+}
 
+// p * M for n points, each divided by its w
+static void transformPoints(const mat4 &M, const vec3* in, vec3* out, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    // four points at a time, one lane per point
+    for (; i + 4 <= n; i += 4) {
+        const vec3* p = in + i;
+        __m128 x = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+        __m128 y = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+        __m128 z = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+        alignas(16) float r[4][4];
+        for (int c = 0; c < 4; c++) {
+            __m128 v = _mm_mul_ps(_mm_set1_ps(M[0][c]), x);
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(M[1][c]), y));
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(M[2][c]), z));
+            v = _mm_add_ps(v, _mm_set1_ps(M[3][c]));
+            _mm_store_ps(r[c], v);
+        }
+        __m128 w = _mm_load_ps(r[3]);
+        _mm_store_ps(r[0], _mm_div_ps(_mm_load_ps(r[0]), w));
+        _mm_store_ps(r[1], _mm_div_ps(_mm_load_ps(r[1]), w));
+        _mm_store_ps(r[2], _mm_div_ps(_mm_load_ps(r[2]), w));
+        for (int k = 0; k < 4; k++) out[i + k] = vec3(r[0][k], r[1][k], r[2][k]);
+    }
+#endif
+    for (; i < n; i++) {
+        vec4 tempPos = M * vec4(in[i], 1.0f);
+        out[i] = vec3(tempPos[0]/tempPos[3], tempPos[1]/tempPos[3], tempPos[2]/tempPos[3]);
+    }
+}
+
+#if defined(__SSE2__)
+// x, y and z scaled to unit length, lane by lane
+static inline void normalize4(__m128 &x, __m128 &y, __m128 &z) {
+    __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    __m128 inv_len = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len2));
+    x = _mm_mul_ps(x, inv_len);
+    y = _mm_mul_ps(y, inv_len);
+    z = _mm_mul_ps(z, inv_len);
+}
+#endif
+
+// normalize(N * normalize(v)) for n normals
+static void transformNormals(const mat3 &N, const vec3* in, vec3* out, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        const vec3* v = in + i;
+        __m128 x = _mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x);
+        __m128 y = _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y);
+        __m128 z = _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z);
+        normalize4(x, y, z);
+        __m128 r[3];
+        for (int c = 0; c < 3; c++) {
+            r[c] = _mm_mul_ps(_mm_set1_ps(N[0][c]), x);
+            r[c] = _mm_add_ps(r[c], _mm_mul_ps(_mm_set1_ps(N[1][c]), y));
+            r[c] = _mm_add_ps(r[c], _mm_mul_ps(_mm_set1_ps(N[2][c]), z));
+        }
+        normalize4(r[0], r[1], r[2]);
+        alignas(16) float rx[4], ry[4], rz[4];
+        _mm_store_ps(rx, r[0]);
+        _mm_store_ps(ry, r[1]);
+        _mm_store_ps(rz, r[2]);
+        for (int k = 0; k < 4; k++) out[i + k] = vec3(rx[k], ry[k], rz[k]);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = normalize(N * normalize(in[i]));
+    }
+}
+
+// Calls fn(k, begin, end) for every piece of the spans [starts[k], starts[k+1])
+// that falls into one parallel chunk of [0, starts.back()), so that the work is
+// balanced however unevenly it is split into spans.
+template <typename Starts, typename F>
+static void parallelSpans(const Starts &starts, F fn) {
+    const int n = int(starts.back());
+    parallelChunks(n, chunkCount(n, RTScene::flatten_chunk_size), [&](int c, int begin, int end){
+        size_t k = std::upper_bound(starts.begin(), starts.end(), size_t(begin)) - starts.begin() - 1;
+        for (size_t i = begin; i < size_t(end); k++) {
+            size_t span_end = std::min(starts[k+1], size_t(end));
+            if (span_end > i) fn(int(k), i, span_end);
+            i = span_end;
+        }
+    });
+}
+
+void RTScene::flattenModels(const std::vector<size_t> &ranges, TriangleSoup &soup, size_t soup_first) {
+    const int n = int(ranges.size());
+    if (n == 0) return;
+    
+    // one model and one normal matrix per model, and where its vertices and
+    // triangles start among those of all the models being flattened
+    // (scratch of this build, in the frame arena)
+    ArenaVector<mat4> M( n, mat4(1.0f), ArenaAllocator<mat4>(frame_arena) );
+    ArenaVector<mat3> N( n, mat3(1.0f), ArenaAllocator<mat3>(frame_arena) );
+    ArenaVector<size_t> vertex_start( n + 1, 0, ArenaAllocator<size_t>(frame_arena) );
+    ArenaVector<size_t> triangle_start( n + 1, 0, ArenaAllocator<size_t>(frame_arena) );
+    for (int k = 0; k < n; k++) {
+        const RTSoupRange &range = soup_ranges[ ranges[k] ];
+        const RTVisit &visit = visits[range.visit];
+        const RTGeometry* geom = visit.node -> models[range.model_index] -> geometry;
+        //in world coordinate system
+        M[k] = visit.M * (visit.node -> modeltransforms[range.model_index]);
+        N[k] = inverse(transpose(mat3(M[k])));
+        vertex_start[k+1] = vertex_start[k] + geom -> view.positions.size();
+        triangle_start[k+1] = triangle_start[k] + geom -> triangleCount();
+    }
+    
+    // transform every vertex once, however many triangles share it
+    ArenaVector<vec3> positions( vertex_start[n], vec3(0.0f), ArenaAllocator<vec3>(frame_arena) );
+    ArenaVector<vec3> normals( vertex_start[n], vec3(0.0f), ArenaAllocator<vec3>(frame_arena) );
+    parallelSpans(vertex_start, [&](int k, size_t begin, size_t end){
+        const RTSoupRange &range = soup_ranges[ ranges[k] ];
+        const RTGeometry* geom = visits[range.visit].node -> models[range.model_index] -> geometry;
+        size_t first = begin - vertex_start[k];
+        transformPoints(M[k], &geom -> view.positions[first], &positions[begin], end - begin);
+        transformNormals(N[k], &geom -> view.normals[first], &normals[begin], end - begin);
+    });
+    
+    // then copy the corners of each triangle into its place in the soup
+    parallelSpans(triangle_start, [&](int k, size_t begin, size_t end){
+        const RTSoupRange &range = soup_ranges[ ranges[k] ];
+        const RTModel* model = visits[range.visit].node -> models[range.model_index];
+        const RTGeometry* geom = model -> geometry;
+        const vec3* P = &positions[ vertex_start[k] ];
+        const vec3* Nv = &normals[ vertex_start[k] ];
+        for (size_t t = begin - triangle_start[k]; t < end - triangle_start[k]; t++) {
+            const glm::uvec3 &tri = geom -> view.triangles[t];
+            size_t i = range.first - soup_first + t;
+            for (int j = 0; j < 3; j++) {
+                soup.positions[3*i + j] = P[ tri[j] ];
+                soup.normals[3*i + j] = Nv[ tri[j] ];
+            }
+            soup.materials[i] = model -> material_id;
+        }
+    });
+}
+
+bool RTScene::buildClusters() {
+    size_t total = buildSoupRanges();
+    // nothing of the in-core soup is kept
+    triangle_soup = TriangleSoup();
+    bvh = BVH();
+    
+    // batches of consecutive models, flattened twice: once to count the triangles
+    // of every cell of the grid the clusters are cut from, once to write them
+    std::vector<size_t> batch_start(1, 0);
+    for (size_t r = 1; r < soup_ranges.size(); r++) {
+        if (soup_ranges[r].first - soup_ranges[ batch_start.back() ].first >= cluster_batch_size) batch_start.push_back(r);
+    }
+    batch_start.push_back( soup_ranges.size() );
+    
+    clusters.begin(cluster_path, bounds());
+    TriangleSoup batch;
+    std::vector<size_t> ranges;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t b = 0; b + 1 < batch_start.size(); b++) {
+            size_t first = batch_start[b] < soup_ranges.size() ? soup_ranges[ batch_start[b] ].first : total;
+            size_t end = batch_start[b+1] < soup_ranges.size() ? soup_ranges[ batch_start[b+1] ].first : total;
+            ranges.clear();
+            for (size_t r = batch_start[b]; r < batch_start[b+1]; r++) ranges.push_back(r);
+            frame_arena.reset(); // the scratch of the last batch
+            batch.resize(end - first);
+            flattenModels(ranges, batch, first);
+            if (pass == 0) clusters.count(batch);
+            else clusters.write(batch);
+        }
+        if (pass == 0 && !clusters.layout()) return false;
+    }
+    batch = TriangleSoup();
+    if (!clusters.finish(bvh_width, bvh_quantized, bvh_mode)) return false;
+    
+    std::cout << "Finished writing " << clusters.triangleCount() << " triangles in " << clusters.size() << " clusters." << std::endl;
+    if (!clusters.empty()) printBuildStats(clusters.bvh, "Cluster");
+    return true;
+}
+
+void RTScene::buildBVH() {
+    // bounding box of every triangle in the soup
+    std::vector<AABB> bounds( triangle_soup.size() );
+    for (size_t i = 0; i < triangle_soup.size(); i++) {
+        for (size_t j = 0; j < 3; j++) {
+            bounds[i].grow( triangle_soup.positions[3*i + j] );
+        }
+    }
+    // the soup is regenerated in the same order every time, so a soup of the same size can be refitted
+    bvh.leaf_alignment = triangle_block_width;
+    refitOrBuild(bvh, bounds, "Triangle soup");
+    packTriangleBlocks(bvh, [this](int i){ return triangle_soup.edges(i); }, triangle_soup.blocks);
+    std::cout << "Triangle soup uses " << triangle_soup.blockBytes() << " bytes of blocks (hot), "
+              << triangle_soup.positionBytes() << " of positions, " << triangle_soup.normalBytes() << " of normals and "
+              << triangle_soup.materialBytes() << " of materials (cold)" << std::endl;
+}
+
+
+void RTScene::buildInstances() {
+    // instances found in this traversal of the scene graph
+    std::vector<RTInstance> found;
+    
+    for (size_t v = 0; v < visits.size(); v++) {
+        RTNode* cur = visits[v].node;
+        
+        //record one instance per model at the current node; the geometry itself is shared
+        for ( size_t i = 0; i < cur -> models.size(); i++ ){
+            RTGeometry* geom = ( cur -> models[i] ) -> geometry;
+            
+            //bottom-level BVH is built once per geometry, in the model coordinate,
+            //and written to the geometry's cache file whenever it changes
+            if ((geom -> bvh.empty() || geom -> bvh.mode != bvh_mode) && geom -> triangleCount() > 0) {
+                geom -> bvh.width = bvh_width;
+                geom -> bvh.mode = bvh_mode;
+                geom -> bvh.quantized = bvh_quantized;
+                geom -> buildBVH();
+                printBuildStats(geom -> bvh, "Geometry");
+                RTCache::save(*geom);
+            }
+            else if (geom -> bvh.width != bvh_width || geom -> bvh.quantized != bvh_quantized) {
+                geom -> bvh.collapse(bvh_width, bvh_quantized);
+                RTCache::save(*geom);
+            }
+            if (geom -> bvh.empty()) continue;
+            
+            RTInstance inst;
+            inst.model = cur -> models[i];
+            inst.visit = int(v);
+            inst.model_index = int(i);
+            inst.M = visits[v].M * (cur -> modeltransforms[i]);
+            found.push_back(inst);
+        }
+    }
+    
+    //same models in the same order as before: only transforms may have changed (e.g. after a settings change)
+    bool same_topology = ( found.size() == instances.size() );
+    for (size_t i = 0; same_topology && i < found.size(); i++) {
+        same_topology = ( found[i].model == instances[i].model );
+    }
+    
+    size_t changed = 0;
+    if (same_topology) {
+        for (size_t i = 0; i < found.size(); i++) {
+            instances[i].visit = found[i].visit;
+            instances[i].model_index = found[i].model_index;
+            if (found[i].M != instances[i].M) {
+                instances[i].setTransform(found[i].M);
+                changed++;
+            }
+        }
+    }
+    else {
+        instances = found;
+        for (RTInstance &inst : instances) {
+            inst.setTransform(inst.M);
+        }
+        tlas = BVH(); // force a rebuild
+    }
+    
+    //top-level BVH over the instance boxes; the bottom-level ones never change with the transforms
+    if (changed > 0 || tlas.empty() || tlas.width != bvh_width || tlas.mode != bvh_mode || tlas.quantized != bvh_quantized) {
+        std::vector<AABB> bounds( instances.size() );
+        for (size_t i = 0; i < instances.size(); i++) {
+            bounds[i] = instances[i].box;
+        }
+        refitOrBuild(tlas, bounds, "Top-level");
+    }
+    
+    std::cout << "Finished building instances (" << changed << " transforms changed)." << std::endl;
+    std::cout << "instances: " << instances.size() << ", TLAS nodes: " << tlas.nodes.size() << std::endl;
+}
+
+void RTScene::buildLevelBVHs() {
+    for (const RTInstance &inst : instances) {
+        RTGeometry* geom = inst.model -> geometry;
+        if (geom -> buildLevelBVHs() > 0) {
+            std::cout << "Geometry level of detail BVHs built over";
+            for (const RTGeometry::Level &level : geom -> levels) std::cout << " " << level.view.size();
+            std::cout << " triangles (error up to " << geom -> levels.back().error << ")" << std::endl;
+        }
+    }
+}
+
+void RTScene::updateInstances() {
+    // only the instances below a changed node move; their BLASes stay as they are
+    size_t changed = 0;
+    for (RTInstance &inst : instances) {
+        const RTVisit &visit = visits[inst.visit];
+        if (!visit.changed) continue;
+        mat4 M = visit.M * (visit.node -> modeltransforms[inst.model_index]);
+        if (M != inst.M) {
+            inst.setTransform(M);
+            changed++;
+        }
+    }
+    if (changed > 0) {
+        std::vector<AABB> bounds( instances.size() );
+        for (size_t i = 0; i < instances.size(); i++) {
+            bounds[i] = instances[i].box;
+        }
+        refitOrBuild(tlas, bounds, "Top-level");
+    }
+    
+    std::cout << "Updated instances (" << changed << " transforms changed)." << std::endl;
+}
@@ -8,43 +8,43 @@ Scene.inl contains the definition of the scene graph
 using namespace glm;
 void RTScene::init(void){
     // Create a geometry palette
-    geometry["cube"] = new RTCube;
-    geometry["teapot"] = new RTObj;
+    geometry["cube"] = arena.make<RTCube>();
+    geometry["teapot"] = arena.make<RTObj>();
     geometry["cube"] -> init();
     geometry["teapot"] -> init("models/teapot.obj");
     
     // Create a material palette
-    material["wood"] = new Material;
+    material["wood"] = arena.make<Material>();
     material["wood"] -> ambient = vec4(0.1f,0.1f,0.1f,1.0f);
     material["wood"] -> diffuse = vec4(0.3f,0.15f,0.1f,1.0f);
     material["wood"] -> specular = vec4(0.3f,0.15f,0.1f,1.0f);
     material["wood"] -> shininess = 100.0f;
     
-    material["ceramic"] = new Material;
+    material["ceramic"] = arena.make<Material>();
     material["ceramic"] -> ambient = vec4(0.02f, 0.07f, 0.2f, 1.0f);
     material["ceramic"] -> diffuse = vec4(0.1f, 0.25f, 0.7f, 1.0f);
     material["ceramic"] -> specular = vec4(0.9f, 0.9f, 0.9f, 1.0f);
     material["ceramic"] -> shininess = 150.0f;
  
-    material["silver"] = new Material;
+    material["silver"] = arena.make<Material>();
     material["silver"] -> ambient = vec4(0.1f, 0.1f, 0.1f, 1.0f);
     material["silver"] -> diffuse = vec4(0.2f, 0.2f, 0.2f, 1.0f);
     material["silver"] -> specular = vec4(0.9f, 0.9f, 0.9f, 1.0f);
     material["silver"] -> shininess = 50.0f;
     
-    material["turquoise"] = new Material;
+    material["turquoise"] = arena.make<Material>();
     material["turquoise"] -> ambient = vec4(0.1f, 0.2f, 0.17f, 1.0f);
     material["turquoise"] -> diffuse = vec4(0.2f, 0.375f, 0.35f, 1.0f);
     material["turquoise"] -> specular = vec4(0.9f, 0.9f, 0.9f, 1.0f);
     material["turquoise"] -> shininess = 100.0f;
     
-    material["pink"] = new Material;
+    material["pink"] = arena.make<Material>();
     material["pink"] -> ambient = vec4(0.2f, 0.07f, 0.2f, 1.0f);
     material["pink"] -> diffuse = vec4(0.13f, 0.35f, 0.3f, 1.0f);
     material["pink"] -> specular = vec4(0.9f, 0.6f, 0.6f, 1.0f);
     material["pink"] -> shininess = 100.0f;
     
-//    material["bulb"] = new Material;
+//    material["bulb"] = arena.make<Material>();
 //    material["bulb"] -> ambient = vec4(0.0f, 0.0f, 0.0f, 1.0f);
 //    material["bulb"] -> diffuse = vec4(0.0f, 0.0f, 0.0f, 1.0f);
 //    material["bulb"] -> specular = vec4(1.0f, 1.0f, 1.0f, 1.0f);
@@ -52,35 +52,35 @@ void RTScene::init(void){
 //    material["bulb"] -> shininess = 200.0f;
     
     // Create a model palette
-    model["teapot1"] = new RTModel;
+    model["teapot1"] = arena.make<RTModel>();
     model["teapot1"] -> geometry = geometry["teapot"];
     model["teapot1"] -> material = material["pink"];
-    model["teapot2"] = new RTModel;
+    model["teapot2"] = arena.make<RTModel>();
     model["teapot2"] -> geometry = geometry["teapot"];
     model["teapot2"] -> material = material["ceramic"];
-    model["table piece"] = new RTModel;
+    model["table piece"] = arena.make<RTModel>();
     model["table piece"] -> geometry = geometry["cube"];
     model["table piece"] -> material = material["wood"];
-//    model["bulb"] = new RTModel;
+//    model["bulb"] = arena.make<RTModel>();
 //    model["bulb"] -> geometry = geometry["cube"];
 //    model["bulb"] -> material = material["bulb"];
     
     // Create a light palette
-    light["sun"] = new Light;
+    light["sun"] = arena.make<Light>();
 //    light["sun"] -> position = vec4(3.0f,2.0f,1.0f,0.0f);
     light["sun"] -> position = vec4(0.0f, 2.0f, 1.0f,0.0f); //behind camera
     light["sun"] -> color = vec4(1.0f,1.0f,1.0f,1.0f);
     
-//    light["bulb"] = new Light;
+//    light["bulb"] = arena.make<Light>();
 //    light["bulb"] -> position = vec4(0.0f,2.0f,0.0f,0.0f);
 //    light["bulb"] -> color = 1.5f * vec4(1.0f,0.2f,0.1f,1.0f);
     
     // Build the scene graph
-    node["table"] = new RTNode;
-    node["table top"] = new RTNode;
-    node["table leg"] = new RTNode;
-    node["teapot1"] = new RTNode;
-    node["teapot2"] = new RTNode;
+    node["table"] = arena.make<RTNode>();
+    node["table top"] = arena.make<RTNode>();
+    node["table leg"] = arena.make<RTNode>();
+    node["teapot1"] = arena.make<RTNode>();
+    node["teapot2"] = arena.make<RTNode>();
     
     node["table"] -> childnodes.push_back( node["table top"] );
     node["table"] -> childtransforms.push_back( translate(vec3(0.0f,1.2f,0.0f)) );
@@ -114,7 +114,7 @@ void RTScene::init(void){
 //    node["world"] -> modeltransforms.push_back( translate(vec3(0.0f,2.0f,0.0f))*scale(vec3(0.1f)) );
     
     // Put a camera
-    camera = new Camera;
+    camera = arena.make<Camera>();
     camera -> target_default = vec3( 0.0f, 1.0f, 0.0f );
     camera -> eye_default = vec3( 0.0f, 1.0f, 5.0f );
     camera -> up_default = vec3( 0.0f, 1.0f, 0.0f );
@@ -2,15 +2,29 @@
 Scene.cpp contains the implementation of the draw command
 *****************************************************/
 #include "Scene.h"
-#include "Cube.h"
-#include "Obj.h"
-
-// The scene init definition 
-#include "Scene.inl"
 
 
 using namespace glm;
+void Scene::init(RTScene* scene){
+    source = scene;
+    
+    // Upload every mesh of the scene
+    for ( const RTGeometry* geom : source -> geometry ){
+        buffers[geom].init(*geom);
+    }
+    
+    // Initialize shader
+    shader = new SurfaceShader;
+    shader -> read_source( "shaders/projective.vert", "shaders/lighting.frag" );
+    shader -> compile();
+    glUseProgram(shader -> program);
+    shader -> initUniforms();
+}
+
 void Scene::draw(void){
+    Camera* camera = source -> camera;
+    const Palette< Light > &light = source -> light;
+    
     // Pre-draw sequence: assign uniforms that are the same for all Geometry::draw call.  These uniforms include the camera view, proj, and the lights.  These uniform do not include modelview and material parameters.
     camera -> computeMatrices();
     shader -> view = camera -> view;
@@ -19,36 +33,44 @@ void Scene::draw(void){
     shader -> lightpositions.resize( shader -> nlights );
     shader -> lightcolors.resize( shader -> nlights );
     int count = 0;
-    for (std::pair<std::string, Light*> entry : light){
-        shader -> lightpositions[ count ] = (entry.second) -> position;
-        shader -> lightcolors[ count ] = (entry.second) -> color;
+    for (const Light* entry : light){
+        shader -> lightpositions[ count ] = entry -> position;
+        shader -> lightcolors[ count ] = entry -> color;
         count++;
     }
     
-    // Define stacks for depth-first search (DFS)
-    std::stack < Node* > dfs_stack;
-    std::stack < mat4 >  matrix_stack; // HW3: You will update this matrix_stack during the depth-first search while loop.
+    // pixels covered by one unit at distance 1 from the eye, for the levels of detail
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixels_per_unit = 0.5f * float(viewport[3]) * camera -> proj[1][1];
+    
+    // Compute total number of connectivities in the graph; this would be an upper bound for
+    // the stack size in the depth first search over the directed acyclic graph
+    size_t total_number_of_edges = 0; 
+    for ( const RTNode* n : source -> node ) total_number_of_edges += n -> childnodes.size();
+    
+    // Define stacks for depth-first search (DFS), sized once in the frame arena
+    frame_arena.reset();
+    ArenaVector < RTNode* > dfs_stack( (ArenaAllocator<RTNode*>(frame_arena)) );
+    ArenaVector < mat4 >  matrix_stack( (ArenaAllocator<mat4>(frame_arena)) ); // HW3: You will update this matrix_stack during the depth-first search while loop.
+    dfs_stack.reserve( total_number_of_edges + 1 );
+    matrix_stack.reserve( total_number_of_edges + 1 );
     
     // Initialize the current state variable for DFS
-    Node* cur = node["world"]; // root of the tree
+    RTNode* cur = source -> world; // root of the tree
     mat4 cur_VM = camera -> view; // HW3: You will update this current modelview during the depth first search.  Initially, we are at the "world" node, whose modelview matrix is just camera's view matrix.
     
     // HW3: The following is the beginning of the depth-first search algorithm.
     // HW3: The depth-first search for the node traversal has already been implemented (cur, dfs_stack).
     // HW3: All you have to do is to also update the states of (cur_VM, matrix_stack) alongside the traversal.  You will only need to modify starting from this line.
-    dfs_stack.push(cur);
+    dfs_stack.push_back(cur);
     /**
      * TODO: (HW3 hint: you should do something here)
      */
-    matrix_stack.push(cur_VM);
-    
-    // Compute total number of connectivities in the graph; this would be an upper bound for
-    // the stack size in the depth first search over the directed acyclic graph
-    int total_number_of_edges = 0; 
-    for ( const auto &n : node ) total_number_of_edges += n.second->childnodes.size();
+    matrix_stack.push_back(cur_VM);
     
     // If you want to print some statistics of your scene graph
-    // std::cout << "total numb of nodes = " << node.size() << std::endl;
+    // std::cout << "total numb of nodes = " << source -> node.size() << std::endl;
     // std::cout << "total number of edges = " << total_number_of_edges << std::endl;
     
     while( ! dfs_stack.empty() ){
@@ -59,11 +81,11 @@ void Scene::draw(void){
         }
         
         // top-pop the stacks
-        cur = dfs_stack.top();  dfs_stack.pop();
+        cur = dfs_stack.back();  dfs_stack.pop_back();
         /**
          * TODO: (HW3 hint: you should do something here)
          */
-        cur_VM = matrix_stack.top();  matrix_stack.pop();
+        cur_VM = matrix_stack.back();  matrix_stack.pop_back();
         
         // draw all the models at the current node
         for ( size_t i = 0; i < cur -> models.size(); i++ ){
@@ -76,18 +98,27 @@ void Scene::draw(void){
             shader -> modelview = cur_VM * (cur -> modeltransforms[i]); // TODO: HW3: Without updating cur_VM, modelview would just be camera's view matrix.
             shader -> material  = ( cur -> models[i] ) -> material;
             
+            // The level of detail: how many pixels a model unit covers at the near side of the
+            // bounding sphere, from the largest scale of the modelview; the full mesh if the
+            // camera is inside the sphere
+            Geometry &buffer = buffers[ ( cur -> models[i] ) -> geometry ];
+            const mat4 &MV = shader -> modelview;
+            float scale = max( length(vec3(MV[0])), max( length(vec3(MV[1])), length(vec3(MV[2])) ) );
+            float near_dist = -( MV * vec4(buffer.center, 1.0f) ).z - scale * buffer.radius;
+            int level = near_dist > 0.0f ? buffer.selectLevel( pixels_per_unit * scale / near_dist, lod_pixel_error ) : 0;
+            
             // The draw command
             shader -> setUniforms();
-            ( cur -> models[i] ) -> geometry -> draw();
+            buffer.draw(level);
         }
         
         // Continue the DFS: put all the child nodes of the current node in the stack
         for ( size_t i = 0; i < cur -> childnodes.size(); i++ ){
-            dfs_stack.push( cur -> childnodes[i] );
+            dfs_stack.push_back( cur -> childnodes[i] );
             /**
              * TODO: (HW3 hint: you should do something here)
              */
-            matrix_stack.push( cur_VM * (cur -> childtransforms[i]) );
+            matrix_stack.push_back( cur_VM * (cur -> childtransforms[i]) );
         }
         
     } // End of DFS while loop.
@@ -0,0 +1,299 @@
+/**************************************************
+Simplify.cpp contains the quadrics, the welding of
+the vertices into points, and the passes of edge
+collapses that make every level of detail.
+*****************************************************/
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "Simplify.h"
+
+using namespace glm;
+
+static const uint32_t no_point = 0xFFFFFFFFu;
+// weight of the planes through the open borders, relative to the triangles
+static const double border_weight = 10.0;
+// a collapse may turn a triangle by at most acos(flip_cos)
+static const float flip_cos = 0.25f;
+
+// Sum of weighted squared distances to planes, as the symmetric 4x4 matrix of
+// the plane equations, and the sum of the weights.
+struct Quadric {
+    double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0;
+    double yy = 0.0, yz = 0.0, yw = 0.0;
+    double zz = 0.0, zw = 0.0;
+    double ww = 0.0;
+    double weight = 0.0;
+
+    // the plane a*x + b*y + c*z + d = 0, with (a, b, c) of unit length
+    void addPlane(double a, double b, double c, double d, double w){
+        xx += w*a*a; xy += w*a*b; xz += w*a*c; xw += w*a*d;
+        yy += w*b*b; yz += w*b*c; yw += w*b*d;
+        zz += w*c*c; zw += w*c*d;
+        ww += w*d*d;
+        weight += w;
+    }
+    Quadric& operator+=(const Quadric &q){
+        xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+        yy += q.yy; yz += q.yz; yw += q.yw;
+        zz += q.zz; zw += q.zw;
+        ww += q.ww;
+        weight += q.weight;
+        return *this;
+    }
+    // weighted mean of the squared distances of p to the planes
+    double error(const vec3 &p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = xx*x*x + 2.0*xy*x*y + 2.0*xz*x*z + 2.0*xw*x
+                 + yy*y*y + 2.0*yz*y*z + 2.0*yw*y
+                 + zz*z*z + 2.0*zw*z
+                 + ww;
+        return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+// collapse of the point from onto the point to
+struct Collapse {
+    double cost;
+    uint32_t from, to;
+
+    bool operator<(const Collapse &c) const {
+        if (cost != c.cost) return cost < c.cost;
+        if (from != c.from) return from < c.from;
+        return to < c.to;
+    }
+};
+
+static inline uint64_t edgeKey(uint32_t a, uint32_t b){
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+static inline bool lessPosition(const vec3 &a, const vec3 &b){
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.z < b.z;
+}
+
+// The mesh being simplified: its current triangles over the vertices of the full
+// mesh, and the points (distinct positions) the vertices are welded into.
+class Simplifier {
+public:
+    Simplifier(const ArrayView<vec3> &positions, const ArrayView<vec3> &normals, const ArrayView<uvec3> &triangles);
+    // collapses edges, cheapest first, until about target triangles are left or no collapse
+    // is possible; returns false in that case.  max_cost grows to the costliest collapse made.
+    bool pass(size_t target, double &max_cost);
+
+    std::vector<uvec3> triangles;
+
+private:
+    ArrayView<vec3> normals;
+    std::vector<uint32_t> point_of;       // point of every vertex
+    std::vector<vec3> point_position;
+    std::vector<uint32_t> first_vertex;   // first vertex of every point
+    std::vector<uint32_t> next_vertex;    // next vertex of the same point, or no_point
+    std::vector<Quadric> quadric;         // of every point
+    std::vector<uint32_t> collapse_to;    // point a point was collapsed onto in this pass, or no_point
+
+    bool degenerate(const uvec3 &t) const {
+        return point_of[t[0]] == point_of[t[1]] || point_of[t[1]] == point_of[t[2]] || point_of[t[2]] == point_of[t[0]];
+    }
+    uint32_t closestVertex(uint32_t point, const vec3 &normal) const;
+};
+
+Simplifier::Simplifier(const ArrayView<vec3> &positions, const ArrayView<vec3> &normals_, const ArrayView<uvec3> &input)
+    : normals(normals_) {
+    // weld: sort the vertices by position and give every distinct position a point
+    const size_t n = positions.size();
+    std::vector<uint32_t> order(n);
+    for (size_t v = 0; v < n; v++) order[v] = uint32_t(v);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        if (lessPosition(positions[a], positions[b])) return true;
+        if (lessPosition(positions[b], positions[a])) return false;
+        return a < b;
+    });
+    point_of.resize(n);
+    next_vertex.assign(n, no_point);
+    for (size_t k = 0; k < n; k++) {
+        uint32_t v = order[k];
+        if (k == 0 || lessPosition(positions[order[k-1]], positions[v])) {
+            point_position.push_back(positions[v]);
+            first_vertex.push_back(v);
+        }
+        else {
+            next_vertex[order[k-1]] = v;
+        }
+        point_of[v] = uint32_t(point_position.size() - 1);
+    }
+    quadric.resize(point_position.size());
+    collapse_to.assign(point_position.size(), no_point);
+
+    triangles.reserve(input.size());
+    for (size_t i = 0; i < input.size(); i++) {
+        if (!degenerate(input[i])) triangles.push_back(input[i]);
+    }
+
+    // the planes of the triangles, weighted by their area
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * triangles.size());
+    for (const uvec3 &t : triangles) {
+        uint32_t p[3] = { point_of[t[0]], point_of[t[1]], point_of[t[2]] };
+        vec3 c = cross(point_position[p[1]] - point_position[p[0]], point_position[p[2]] - point_position[p[0]]);
+        float len = length(c);
+        for (int j = 0; j < 3; j++) edges.push_back( edgeKey(p[j], p[(j+1)%3]) );
+        if (len == 0.0f) continue;
+        vec3 nrm = c / len;
+        double d = -dot(nrm, point_position[p[0]]);
+        for (int j = 0; j < 3; j++) quadric[p[j]].addPlane(nrm.x, nrm.y, nrm.z, d, 0.5 * len);
+    }
+
+    // an edge of only one triangle is on an open border; a plane through it, across the
+    // triangle, keeps its points from moving off the border
+    std::sort(edges.begin(), edges.end());
+    for (const uvec3 &t : triangles) {
+        uint32_t p[3] = { point_of[t[0]], point_of[t[1]], point_of[t[2]] };
+        vec3 nrm = cross(point_position[p[1]] - point_position[p[0]], point_position[p[2]] - point_position[p[0]]);
+        for (int j = 0; j < 3; j++) {
+            uint64_t key = edgeKey(p[j], p[(j+1)%3]);
+            std::pair< std::vector<uint64_t>::iterator, std::vector<uint64_t>::iterator > range = std::equal_range(edges.begin(), edges.end(), key);
+            if (range.second - range.first != 1) continue;
+            vec3 e = point_position[p[(j+1)%3]] - point_position[p[j]];
+            vec3 side = cross(e, nrm);
+            float len = length(side);
+            if (len == 0.0f) continue;
+            side /= len;
+            double d = -dot(side, point_position[p[j]]);
+            double w = border_weight * dot(e, e);
+            quadric[p[j]].addPlane(side.x, side.y, side.z, d, w);
+            quadric[p[(j+1)%3]].addPlane(side.x, side.y, side.z, d, w);
+        }
+    }
+}
+
+uint32_t Simplifier::closestVertex(uint32_t point, const vec3 &normal) const {
+    // the vertex of the point whose normal is closest to normal, so smooth shading stays smooth
+    uint32_t best = first_vertex[point];
+    float best_dot = -2.0f;
+    for (uint32_t v = first_vertex[point]; v != no_point; v = next_vertex[v]) {
+        float d = dot(normals[v], normal);
+        if (d > best_dot) {
+            best_dot = d;
+            best = v;
+        }
+    }
+    return best;
+}
+
+bool Simplifier::pass(size_t target, double &max_cost) {
+    // every edge between two points once, with the cheaper of its two collapses
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * triangles.size());
+    for (const uvec3 &t : triangles) {
+        for (int j = 0; j < 3; j++) edges.push_back( edgeKey(point_of[t[j]], point_of[t[(j+1)%3]]) );
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    std::vector<Collapse> collapses(edges.size());
+    for (size_t e = 0; e < edges.size(); e++) {
+        uint32_t a = uint32_t(edges[e] >> 32), b = uint32_t(edges[e]);
+        Quadric q = quadric[a];
+        q += quadric[b];
+        double cost_ab = q.error(point_position[b]), cost_ba = q.error(point_position[a]);
+        Collapse &c = collapses[e];
+        c.cost = std::min(cost_ab, cost_ba);
+        c.from = cost_ab <= cost_ba ? a : b;
+        c.to = cost_ab <= cost_ba ? b : a;
+    }
+    std::sort(collapses.begin(), collapses.end());
+
+    // the triangles around every point
+    const size_t points = point_position.size();
+    std::vector<uint32_t> first(points + 1, 0), around(3 * triangles.size());
+    for (const uvec3 &t : triangles) {
+        for (int j = 0; j < 3; j++) first[ point_of[t[j]] + 1 ]++;
+    }
+    for (size_t p = 0; p < points; p++) first[p+1] += first[p];
+    std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        for (int j = 0; j < 3; j++) around[ fill[ point_of[triangles[i][j]] ]++ ] = uint32_t(i);
+    }
+
+    // A collapse moves the triangles around its from point, so it locks their points
+    // for the rest of the pass; every collapse is then checked against the triangles
+    // as they are before the pass.
+    std::vector<char> locked(points, 0);
+    std::vector<uint32_t> collapsed;
+    size_t live = triangles.size();
+    for (const Collapse &c : collapses) {
+        if (live <= target) break;
+        if (locked[c.from] || locked[c.to]) continue;
+        bool flips = false;
+        size_t removed = 0;
+        for (uint32_t k = first[c.from]; k < first[c.from + 1] && !flips; k++) {
+            const uvec3 &t = triangles[ around[k] ];
+            uint32_t p[3] = { point_of[t[0]], point_of[t[1]], point_of[t[2]] };
+            if (p[0] == c.to || p[1] == c.to || p[2] == c.to) {
+                removed++;
+                continue;
+            }
+            vec3 P[3], Q[3];
+            for (int j = 0; j < 3; j++) {
+                P[j] = point_position[p[j]];
+                Q[j] = (p[j] == c.from) ? point_position[c.to] : P[j];
+            }
+            vec3 before = cross(P[1] - P[0], P[2] - P[0]);
+            vec3 after = cross(Q[1] - Q[0], Q[2] - Q[0]);
+            flips = dot(before, after) <= flip_cos * length(before) * length(after) && dot(before, before) > 0.0f;
+        }
+        if (flips) continue;
+
+        collapse_to[c.from] = c.to;
+        quadric[c.to] += quadric[c.from];
+        max_cost = std::max(max_cost, c.cost);
+        collapsed.push_back(c.from);
+        locked[c.to] = 1;
+        for (uint32_t k = first[c.from]; k < first[c.from + 1]; k++) {
+            const uvec3 &t = triangles[ around[k] ];
+            for (int j = 0; j < 3; j++) locked[ point_of[t[j]] ] = 1;
+        }
+        live -= removed;
+    }
+    if (collapsed.empty()) return false;
+
+    // move the corners of the collapsed points, and drop the triangles that collapsed with them
+    size_t kept = 0;
+    for (size_t i = 0; i < triangles.size(); i++) {
+        uvec3 t = triangles[i];
+        for (int j = 0; j < 3; j++) {
+            uint32_t to = collapse_to[ point_of[t[j]] ];
+            if (to != no_point) t[j] = closestVertex(to, normals[t[j]]);
+        }
+        if (!degenerate(t)) triangles[kept++] = t;
+    }
+    triangles.resize(kept);
+    for (uint32_t p : collapsed) collapse_to[p] = no_point;
+    return true;
+}
+
+std::vector<Simplify::Level> Simplify::buildLevels(const ArrayView<vec3> &positions, const ArrayView<vec3> &normals,
+                                                   const ArrayView<uvec3> &triangles, size_t min_triangles, int max_levels) {
+    std::vector<Level> levels;
+    if (triangles.size() / 2 < min_triangles || max_levels <= 0) return levels;
+
+    Simplifier mesh(positions, normals, triangles);
+    double max_cost = 0.0; // of all the collapses so far, so the error only grows along the chain
+    while (int(levels.size()) < max_levels) {
+        size_t start = mesh.triangles.size();
+        size_t target = start / 2;
+        if (target < min_triangles) break;
+        while (mesh.triangles.size() > target && mesh.pass(target, max_cost)) {}
+        // a level that is hardly coarser than the one before is not worth its memory
+        if (mesh.triangles.size() > start - start / 10) break;
+
+        levels.push_back(Level());
+        levels.back().triangles = mesh.triangles;
+        levels.back().error = float(sqrt(max_cost));
+    }
+    return levels;
+}